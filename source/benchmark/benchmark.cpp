@@ -0,0 +1,402 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+
+#include <glm/glm.hpp>
+#include <nlohmann/json.hpp>
+
+#include "../camera/camera.hpp"
+#include "../integrator/integrator.hpp"
+#include "../integrator/photon-mapper/photon.hpp"
+#include "../material/fresnel.hpp"
+#include "../surface/surface.hpp"
+#include "../sampling/sampling.hpp"
+#include "../sampling/sampler.hpp"
+#include "../common/coordinate-system.hpp"
+#include "../common/constants.hpp"
+#include "../common/option.hpp"
+#include "../octree/octree.cpp"
+#include "../octree/linear-octree.cpp"
+
+/**************************************************************************
+ Micro-benchmarks of the core kernels of the renderer, each run on a single
+ thread in isolation:
+
+   monte-carlo-ray-tracer-benchmark [scene file] [options]
+
+ The ray and query sets are generated from the first camera of the scene 
+ with a fixed seed, so runs of different builds on the same scene measure 
+ the same work. Each kernel is timed over all of its operations for a 
+ number of repetitions after one warm-up run, and the mean and standard 
+ deviation of the time per operation over the repetitions are reported.
+***************************************************************************/
+
+namespace
+{
+    // Uniform double in [0, 1) from a generator with the same output on all platforms
+    class UniformRandom
+    {
+    public:
+        UniformRandom(uint64_t seed) : engine(seed) { }
+
+        double operator()()
+        {
+            return (engine() >> 11) * 0x1p-53;
+        }
+
+    private:
+        std::mt19937_64 engine;
+    };
+
+    struct Result
+    {
+        std::string name;
+        size_t ops;
+        double ns_mean, ns_stddev;
+        bool rays;
+    };
+
+    // f performs all ops once and returns a value that depends on the work, which keeps it from being optimized away
+    template<class F>
+    Result measure(const std::string &name, size_t ops, size_t repetitions, bool rays, F f)
+    {
+        static volatile double sink;
+
+        sink = f();
+
+        std::vector<double> ns(repetitions);
+        for (auto &t : ns)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            sink = f();
+            auto end = std::chrono::steady_clock::now();
+            t = std::chrono::duration<double, std::nano>(end - begin).count() / ops;
+        }
+
+        // Reading the sink back also catches benchmarks whose work degenerates into NaNs
+        if (std::isnan(sink))
+        {
+            std::cout << "Warning: " << name << " produced NaN" << std::endl;
+        }
+
+        double mean = 0.0;
+        for (double t : ns) mean += t;
+        mean /= repetitions;
+
+        double variance = 0.0;
+        for (double t : ns) variance += (t - mean) * (t - mean);
+        variance /= std::max<size_t>(repetitions - 1, 1);
+
+        Result result{ name, ops, mean, std::sqrt(variance), rays };
+
+        double rate = 1e3 / mean;
+        std::cout << std::left << std::setw(36) << name << std::right
+                  << std::setw(10) << ops
+                  << std::setw(12) << std::fixed << std::setprecision(1) << mean << " ns/op"
+                  << " +- " << std::setw(4) << std::setprecision(1) << 100.0 * result.ns_stddev / mean << "%"
+                  << std::setw(10) << std::setprecision(2) << rate << (rays ? " Mrays/s" : " Mops/s") << std::endl;
+
+        return result;
+    }
+
+    struct Hit
+    {
+        glm::dvec3 position, normal; // normal faces the incoming ray
+        const Surface::Base* surface;
+        uint32_t primitive;
+        size_t ray; // index of the ray that hit
+    };
+
+    void printUsage()
+    {
+        std::cout << "Usage: monte-carlo-ray-tracer-benchmark [scene file] [options]\n\n"
+                  << "  --rays <n>         Number of camera rays and queries of each kernel, 262144 by default.\n"
+                  << "  --repetitions <n>  Number of timed runs of each kernel, 10 by default.\n"
+                  << "  --seed <n>         Seed of the ray and query sets, 0 by default.\n"
+                  << "  --json <file>      Writes the results as JSON to file.\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path scene_file = "scenes/spaceship.json";
+    size_t num_rays = 1 << 18, repetitions = 10;
+    uint64_t seed = 0;
+    std::string json_path;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--help")
+            {
+                printUsage();
+                return 0;
+            }
+            if (arg.rfind("--", 0) != 0)
+            {
+                scene_file = arg;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                throw std::runtime_error("Missing value of " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--rays") num_rays = std::stoull(value);
+            else if (arg == "--repetitions") repetitions = std::max<size_t>(std::stoull(value), 1);
+            else if (arg == "--seed") seed = std::stoull(value);
+            else if (arg == "--json") json_path = value;
+            else throw std::runtime_error("Unknown option " + arg);
+        }
+
+        std::filesystem::path path = std::filesystem::current_path() / scene_file;
+        Scene::path = path.parent_path();
+
+        std::ifstream file(path);
+        if (!file)
+        {
+            throw std::runtime_error("Unable to open " + path.string());
+        }
+        nlohmann::json j;
+        file >> j;
+        file.close();
+
+        auto integrator = Integrator::create(j, false);
+        Camera camera(j, Option(path, "", 0, false), integrator);
+        const Scene &scene = integrator->scene;
+
+        UniformRandom random(seed);
+
+        // Camera rays through random points of the image plane
+        std::vector<Ray> camera_rays;
+        camera_rays.reserve(num_rays);
+        double pixel_size = camera.sensor_width / camera.image.width;
+        glm::dvec2 half_dim = glm::dvec2(camera.image.width, camera.image.height) * 0.5;
+        for (size_t i = 0; i < num_rays; i++)
+        {
+            glm::dvec2 px(random() * camera.image.width, random() * camera.image.height);
+            glm::dvec2 local = pixel_size * (half_dim - px);
+            glm::dvec3 direction = glm::normalize(camera.forward * camera.focal_length + camera.left * local.x + camera.up * local.y);
+            camera_rays.emplace_back(camera.eye, direction, scene.ior);
+        }
+
+        auto hits = [&](const std::vector<Ray> &rays)
+        {
+            std::vector<Hit> result;
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                const Ray &ray = rays[i];
+                Intersection intersection = scene.intersect(ray);
+                if (!intersection) continue;
+                glm::dvec3 position = ray(intersection.t);
+                glm::dvec3 normal = intersection.surface->normal(intersection, position);
+                if (glm::dot(normal, ray.direction) > 0.0) normal = -normal;
+                result.push_back({ position, normal, intersection.surface, intersection.primitive, i });
+            }
+            return result;
+        };
+
+        std::vector<Hit> camera_hits = hits(camera_rays);
+        if (camera_hits.empty())
+        {
+            throw std::runtime_error("No camera rays intersect the scene.");
+        }
+
+        // Cosine weighted diffuse bounces from the camera ray hits
+        std::vector<Ray> diffuse_rays;
+        diffuse_rays.reserve(camera_hits.size());
+        for (const auto &hit : camera_hits)
+        {
+            glm::dvec3 direction = CoordinateSystem::from(Sampling::cosWeightedHemi(random(), random()), hit.normal);
+            diffuse_rays.emplace_back(hit.position + hit.normal * C::EPSILON, direction, scene.ior);
+        }
+        std::vector<Hit> diffuse_hits = hits(diffuse_rays);
+
+        // Shadow rays from the camera ray hits to random points on the light sources
+        struct ShadowRay
+        {
+            Ray ray;
+            double t_max;
+            const Surface::Base* light;
+        };
+        std::vector<ShadowRay> shadow_rays;
+        if (!scene.emissives.empty())
+        {
+            shadow_rays.reserve(camera_hits.size());
+            for (const auto &hit : camera_hits)
+            {
+                double select_probability;
+                const Surface::Base* light = scene.selectLight(random(), select_probability);
+                glm::dvec3 light_pos = light->operator()(random(), random());
+                glm::dvec3 start = hit.position + hit.normal * C::EPSILON;
+                shadow_rays.push_back({ Ray(start, light_pos), glm::distance(start, light_pos), light });
+            }
+        }
+
+        std::cout << std::endl << "Scene: " << path.string() << ", seed: " << seed << ", repetitions: " << repetitions 
+                  << std::endl << std::endl;
+
+        std::vector<Result> results;
+
+        results.push_back(measure("BVH::intersect (camera rays)", camera_rays.size(), repetitions, true, [&]()
+        {
+            double sum = 0.0;
+            for (const auto &ray : camera_rays)
+            {
+                sum += scene.intersect(ray).t < std::numeric_limits<double>::max();
+            }
+            return sum;
+        }));
+
+        results.push_back(measure("BVH::intersect (diffuse rays)", diffuse_rays.size(), repetitions, true, [&]()
+        {
+            double sum = 0.0;
+            for (const auto &ray : diffuse_rays)
+            {
+                sum += scene.intersect(ray).t < std::numeric_limits<double>::max();
+            }
+            return sum;
+        }));
+
+        if (!shadow_rays.empty())
+        {
+            results.push_back(measure("BVH::occluded (shadow rays)", shadow_rays.size(), repetitions, true, [&]()
+            {
+                double sum = 0.0;
+                for (const auto &s : shadow_rays)
+                {
+                    sum += scene.occluded(s.ray, s.t_max, s.light);
+                }
+                return sum;
+            }));
+        }
+
+        // The primitive each camera ray hit and a random primitive of the same surface, i.e. about half misses
+        std::vector<std::pair<const Ray*, Hit>> primitive_tests;
+        for (Hit hit : camera_hits)
+        {
+            primitive_tests.push_back({ &camera_rays[hit.ray], hit });
+            hit.primitive = static_cast<uint32_t>(random() * hit.surface->numPrimitives());
+            primitive_tests.push_back({ &camera_rays[hit.ray], hit });
+        }
+
+        results.push_back(measure("Surface::intersect (primitives)", primitive_tests.size(), repetitions, true, [&]()
+        {
+            double sum = 0.0;
+            for (const auto &[ray, hit] : primitive_tests)
+            {
+                Intersection intersection;
+                if (hit.surface->intersect(*ray, hit.primitive, intersection)) sum += intersection.t;
+            }
+            return sum;
+        }));
+
+        // Photons at the diffuse ray hits, queried at the camera ray hits
+        if (!diffuse_hits.empty())
+        {
+            Octree<Photon> octree(scene.BB(), 200);
+            for (const auto &hit : diffuse_hits)
+            {
+                glm::dvec3 direction = CoordinateSystem::from(Sampling::cosWeightedHemi(random(), random()), hit.normal);
+                octree.insert(Photon(glm::dvec3(random(), random(), random()), hit.position, -direction));
+            }
+            LinearOctree<Photon> photon_map(octree);
+
+            const size_t k = 50;
+            results.push_back(measure("LinearOctree::knnSearch (k = 50)", camera_hits.size(), repetitions, false, [&]()
+            {
+                thread_local PriorityQueue<SearchResult<Photon>> photons;
+                double sum = 0.0;
+                for (const auto &hit : camera_hits)
+                {
+                    photon_map.knnSearch(hit.position, k, photons);
+                    sum += photons.empty() ? 0.0 : photons.top().distance2;
+                }
+                return sum;
+            }));
+        }
+
+        results.push_back(measure("Sampler::setIndex, shuffle, get (2D)", num_rays, repetitions, false, [&]()
+        {
+            double sum = 0.0;
+            Sampler::initiate(0);
+            for (uint32_t i = 0; i < num_rays; i++)
+            {
+                Sampler::setIndex(i);
+                Sampler::shuffle();
+                auto u = Sampler::get<Dim::BSDF, 2>();
+                sum += u[0] + u[1];
+            }
+            return sum;
+        }));
+
+        // Samples of one bucket, deposited with the reconstruction filter of the camera
+        Film::Tile tile = camera.film.tile(glm::ivec2(0), glm::ivec2(32));
+        std::vector<glm::dvec2> sample_positions(num_rays);
+        for (auto &p : sample_positions)
+        {
+            p = glm::dvec2(random(), random()) * 32.0;
+        }
+        results.push_back(measure("Film::deposit", num_rays, repetitions, false, [&]()
+        {
+            for (const auto &p : sample_positions)
+            {
+                camera.film.deposit(tile, p, glm::dvec3(1.0));
+            }
+            return tile.data()[0].w;
+        }));
+
+        ComplexIOR gold(glm::dvec3(0.18299, 0.42108, 1.37340), glm::dvec3(3.4242, 2.34590, 1.77040));
+        std::vector<double> cos_thetas(num_rays);
+        for (auto &c : cos_thetas)
+        {
+            c = random();
+        }
+        results.push_back(measure("Fresnel::conductor", num_rays, repetitions, false, [&]()
+        {
+            double sum = 0.0;
+            for (double c : cos_thetas)
+            {
+                sum += Fresnel::conductor(1.0, &gold, c).x;
+            }
+            return sum;
+        }));
+
+        if (!json_path.empty())
+        {
+            nlohmann::json out = {
+                { "scene", path.string() },
+                { "seed", seed },
+                { "repetitions", repetitions },
+                { "kernels", nlohmann::json::array() }
+            };
+            for (const auto &r : results)
+            {
+                out["kernels"].push_back({
+                    { "name", r.name },
+                    { "ops", r.ops },
+                    { "ns_per_op", r.ns_mean },
+                    { "ns_per_op_stddev", r.ns_stddev },
+                    { r.rays ? "mrays_per_second" : "mops_per_second", 1e3 / r.ns_mean }
+                });
+            }
+            std::ofstream(json_path) << out.dump(2) << std::endl;
+        }
+    }
+    catch (const std::exception &ex)
+    {
+        std::cout << ex.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
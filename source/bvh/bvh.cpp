@@ -3,24 +3,54 @@
 #include <queue>
 #include <chrono>
 #include <iostream>
+#include <bit>
+#include <unordered_map>
+#include <thread>
+#include <array>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 #include "../octree/octree.cpp"
 #include "../common/format.hpp"
 #include "../surface/surface.hpp"
 #include "../common/util.hpp"
-#include "../common/priority-queue.hpp"
+#include "../common/work-queue.hpp"
+#include "../common/bundle.hpp"
+#include "../common/perf-counters.hpp"
 
 BVH::BVH(const BoundingBox &BB, 
          const std::vector<std::shared_ptr<Surface::Base>> &surfaces, 
-         const nlohmann::json &j)
+         const nlohmann::json &j,
+         uint32_t level)
+    : level(level)
 {
     df_idx = 0;
 
-    std::shared_ptr<BuildNode> root = std::make_shared<BuildNode>();
+    num_build_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<BuildThread> build_threads(num_build_threads);
+
+    BuildNode* root = build_threads[0].newNode();
     root->BB = BB;
 
     auto begin = std::chrono::high_resolution_clock::now();
 
+    // Surfaces made up of several primitives, e.g. triangle meshes, are split into their primitives
+    std::vector<Primitive> primitives;
+    for (const auto &s : surfaces)
+    {
+        for (uint32_t i = 0; i < s->numPrimitives(); i++)
+        {
+            primitives.push_back({ s.get(), i, (uint32_t)primitives.size() });
+            primitive_BBs.push_back(s->primitiveBB(i));
+        }
+    }
+    uint32_t num_primitives = (uint32_t)primitives.size();
+
+    // Enough tasks per thread to balance the load
+    task_size = std::max(num_primitives / (16 * (uint32_t)num_build_threads), 4096u);
+
     std::string type = getOptional<std::string>(j, "type", "OCTREE");
     std::transform(type.begin(), type.end(), type.begin(), toupper);
 
@@ -28,15 +58,51 @@ BVH::BVH(const BoundingBox &BB,
     {
         bins_per_axis = getOptional(j, "bins_per_axis", 8);
         std::cout << "\nBuilding quaternary BVH using SAH.\n\n";
-        root->surfaces = surfaces;
-        recursiveBuildQuaternarySAH(root);
+        ordered_primitives = std::move(primitives);
+        root->end = num_primitives;
+        buildParallel(root, BuildMethod::QUATERNARY_SAH, build_threads);
     }
     else if (type == "BINARY_SAH")
     {
         bins_per_axis = getOptional(j, "bins_per_axis", 16);
         std::cout << "\nBuilding binary BVH using SAH.\n\n";
-        root->surfaces = surfaces;
-        recursiveBuildBinarySAH(root);
+        ordered_primitives = std::move(primitives);
+        root->end = num_primitives;
+        buildParallel(root, BuildMethod::BINARY_SAH, build_threads);
+    }
+    else if (type == "LBVH")
+    {
+        int ploc_radius = getOptional(j, "ploc_radius", 0);
+        if (ploc_radius > 0)
+        {
+            std::cout << "\nBuilding BVH from Morton codes using PLOC.\n\n";
+        }
+        else
+        {
+            std::cout << "\nBuilding linear BVH from Morton codes.\n\n";
+        }
+        buildLBVH(root, primitives, ploc_radius, build_threads);
+    }
+    else if (type == "SBVH")
+    {
+        bins_per_axis = getOptional(j, "bins_per_axis", 16);
+        spatial_split_alpha = getOptional(j, "spatial_split_alpha", 1e-5);
+        double duplication_budget = getOptional(j, "duplication_budget", 0.25);
+        std::cout << "\nBuilding binary BVH using SAH with spatial splits.\n\n";
+
+        root_area = root->BB.area();
+        num_references = num_primitives;
+        max_references = (size_t)(num_primitives * (1.0 + std::max(duplication_budget, 0.0)));
+
+        std::vector<Reference> references(num_primitives);
+        for (uint32_t i = 0; i < num_primitives; i++)
+        {
+            references[i] = { primitives[i], primitiveBB(primitives[i]) };
+        }
+        primitives = std::vector<Primitive>();
+
+        ordered_primitives.reserve(max_references);
+        recursiveBuildSBVH(root, references, build_threads[0]);
     }
     else // OCTREE
     {
@@ -45,16 +111,19 @@ BVH::BVH(const BoundingBox &BB,
         double half_max = glm::compMax(root->BB.dimensions()) / 2.0;
         BoundingBox cube_BB(root->BB.centroid() - half_max, root->BB.centroid() + half_max);
 
-        Octree<SurfaceCentroid> hierarchy(cube_BB, leaf_surfaces);
+        Octree<PrimitiveCentroid> hierarchy(cube_BB, leaf_surfaces);
 
-        for (const auto &s : surfaces)
+        for (const auto &p : primitives)
         {
-            hierarchy.insert(SurfaceCentroid(s));
+            hierarchy.insert(PrimitiveCentroid(p, primitiveBB(p).centroid()));
         }
 
-        recursiveBuildFromOctree(hierarchy, root);
+        ordered_primitives.reserve(num_primitives);
+        recursiveBuildFromOctree(hierarchy, root, build_threads[0]);
     }
 
+    numberNodes(root);
+
     size_t num_nodes = 1;
     double num_branchings = 0.0;
     for (const auto &b : branching)
@@ -63,414 +132,1909 @@ BVH::BVH(const BoundingBox &BB,
         num_nodes += b.first * b.second;
     }
 
-    ordered_surfaces = std::vector<std::shared_ptr<Surface::Base>>(surfaces.size(), nullptr);
-
     linear_tree = std::vector<LinearNode>(num_nodes, LinearNode());
 
-    uint32_t surface_idx = 0;
-    compact(root, 0, surface_idx);
+    compact(root, 0);
+    build_threads.clear();
+
+    double sah_cost = costSAH();
+
+    reorderPrimitives(surfaces);
+
+    primitive_BBs.clear();
+    primitive_BBs.shrink_to_fit();
+
+    // Collapse into wide tree for SIMD traversal. The linear tree is no longer needed after this.
+    int width = getOptional(j, "width", 0);
+
+    // Root is a leaf if the scene is small
+    std::vector<uint32_t> root_lanes = linear_tree[0].num_surfaces ? std::vector<uint32_t>{ 0 } : children(0);
+    size_t num_wide_nodes = 0, stack_size = 0;
+    if (width == 8)
+    {
+        collapse(root_lanes, wide_tree8);
+        num_wide_nodes = wide_tree8.size();
+        stack_size = stackSize(wide_tree8, 0);
+    }
+    else if (width == 4)
+    {
+        collapse(root_lanes, wide_tree4);
+        num_wide_nodes = wide_tree4.size();
+        stack_size = stackSize(wide_tree4, 0);
+    }
+    else
+    {
+        stack_size = stackSize(0);
+    }
+    if (num_wide_nodes) linear_tree = std::vector<LinearNode>();
+
+    std::string traversal = getOptional<std::string>(j, "traversal", "PRIORITY_QUEUE");
+    std::transform(traversal.begin(), traversal.end(), traversal.begin(), toupper);
+
+    stack_traversal = traversal == "STACK" && stack_size <= TraversalStack::capacity;
 
     auto end = std::chrono::high_resolution_clock::now();
     size_t msec_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
 
     std::cout << "BVH constructed in " + Format::timeDuration(msec_duration)
               << ". Branching factor of tree: " << (num_nodes - 1) / num_branchings << std::endl;
+
+    std::cout << "SAH cost of tree: " << sah_cost;
+    if (type == "SBVH")
+    {
+        std::cout << ". Reference duplication ratio: " << (double)ordered_primitives.size() / num_primitives;
+    }
+    std::cout << std::endl;
+
+    if (num_wide_nodes)
+    {
+        std::cout << "Tree collapsed into " << Format::largeNumber(num_wide_nodes) << " " << width << "-wide nodes." << std::endl;
+    }
+
+    if (traversal == "STACK" && !stack_traversal)
+    {
+        std::cout << "Tree requires a traversal stack of size " << stack_size 
+                  << ", which is too large. Priority queue traversal is used instead." << std::endl;
+    }
+}
+
+// Primitives are stored as surface and primitive indices since the surface pointers change between runs
+BVH::BVH(Bundle::Reader &bundle,
+         const std::vector<std::shared_ptr<Surface::Base>> &surfaces,
+         uint32_t level)
+    : level(level), num_build_threads(1)
+{
+    bundle.read(linear_tree);
+    bundle.read(wide_tree4);
+    bundle.read(wide_tree8);
+    stack_traversal = bundle.read<uint8_t>();
+
+    std::vector<glm::uvec2> primitives;
+    bundle.read(primitives);
+    ordered_primitives.reserve(primitives.size());
+    for (const auto &p : primitives)
+    {
+        if (p.x >= surfaces.size() || p.y >= surfaces[p.x]->numPrimitives())
+        {
+            throw std::runtime_error("BVH primitive in scene bundle out of range.");
+        }
+        ordered_primitives.push_back({ surfaces[p.x].get(), p.y, 0 });
+    }
+
+    // Node indices and leaf ranges are validated as well since traversal doesn't check them
+    auto validateLeaf = [&](uint32_t start_surface, uint8_t num_surfaces)
+    {
+        if ((size_t)start_surface + num_surfaces > ordered_primitives.size())
+        {
+            throw std::runtime_error("BVH leaf in scene bundle out of range.");
+        }
+    };
+
+    // Children are stored after their parent in both tree layouts, which also rules out cycles
+    for (size_t i = 0; i < linear_tree.size(); i++)
+    {
+        const auto &node = linear_tree[i];
+        if (node.num_surfaces)
+        {
+            validateLeaf(node.start_surface, node.num_surfaces);
+        }
+        if ((!node.num_surfaces && i + 1 >= linear_tree.size()) || 
+            (node.next_sibling && (node.next_sibling <= i || node.next_sibling >= linear_tree.size())))
+        {
+            throw std::runtime_error("BVH node in scene bundle out of range.");
+        }
+    }
+
+    auto validateWide = [&](const auto &wide_tree)
+    {
+        for (size_t i = 0; i < wide_tree.size(); i++)
+        {
+            const auto &node = wide_tree[i];
+            for (size_t c = 0; c < std::size(node.child); c++)
+            {
+                if (node.bounds[0][c] > node.bounds[3][c]) continue; // unused lane
+
+                if (node.num_surfaces[c])
+                {
+                    validateLeaf(node.child[c], node.num_surfaces[c]);
+                }
+                else if (node.child[c] <= i || node.child[c] >= wide_tree.size())
+                {
+                    throw std::runtime_error("BVH node in scene bundle out of range.");
+                }
+            }
+        }
+    };
+    validateWide(wide_tree4);
+    validateWide(wide_tree8);
+
+    if (linear_tree.empty() && wide_tree4.empty() && wide_tree8.empty())
+    {
+        throw std::runtime_error("Empty BVH in scene bundle.");
+    }
+
+    // The traversal stack has a fixed capacity, so the stack size is checked like in construction
+    if (stack_traversal)
+    {
+        size_t stack_size = !wide_tree8.empty() ? stackSize(wide_tree8, 0) : 
+                            !wide_tree4.empty() ? stackSize(wide_tree4, 0) : stackSize(0);
+        stack_traversal = stack_size <= TraversalStack::capacity;
+    }
+}
+
+void BVH::write(Bundle::Writer &bundle, const std::vector<std::shared_ptr<Surface::Base>> &surfaces) const
+{
+    bundle.write(linear_tree);
+    bundle.write(wide_tree4);
+    bundle.write(wide_tree8);
+    bundle.write<uint8_t>(stack_traversal);
+
+    std::unordered_map<const Surface::Base*, uint32_t> surface_indices;
+    for (uint32_t i = 0; i < surfaces.size(); i++)
+    {
+        surface_indices[surfaces[i].get()] = i;
+    }
+
+    std::vector<glm::uvec2> primitives;
+    primitives.reserve(ordered_primitives.size());
+    for (const auto &p : ordered_primitives)
+    {
+        primitives.emplace_back(surface_indices.at(p.surface), p.index);
+    }
+    bundle.write(primitives);
 }
 
+/*****************************************************************************
+ Single precision ray used in the wide node slab tests. The near and far slab
+ indices are selected from the direction signs once per ray rather than
+ sorting the entry and exit distances per node.
+******************************************************************************/
+struct BVH::WideRay
+{
+    WideRay(const Ray& ray)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            origin[a] = static_cast<float>(ray.start[a]);
+            inv_direction[a] = static_cast<float>(ray.inv_direction[a]);
+            near[a] = ray.inv_direction[a] >= 0.0 ? a : a + 3;
+            far[a] = ray.inv_direction[a] >= 0.0 ? a + 3 : a;
+        }
+    }
+
+    float origin[3], inv_direction[3];
+    int near[3], far[3];
+};
+
+// Scales the exit distance to account for the rounding errors of the single 
+// precision slab test, 1 + 2 * gamma(3) from Physically Based Rendering 3rd ed.
+static constexpr float ROBUST_EXIT = 1.0000004f;
+
 Intersection BVH::intersect(const Ray& ray) const
 {
-    thread_local PriorityQueue<LinearNode::NodeIntersection> to_visit; to_visit.clear();
+    if (stack_traversal)
+    {
+        thread_local TraversalStack to_visit[max_levels];
+        return traverse(ray, to_visit[level]);
+    }
+    else
+    {
+        thread_local TraversalQueue to_visit[max_levels];
+        return traverse(ray, to_visit[level]);
+    }
+}
+
+template<class Queue>
+Intersection BVH::traverse(const Ray& ray, Queue& to_visit) const
+{
+    to_visit.clear();
+
+    if (!wide_tree8.empty()) return traverseWide(wide_tree8, ray, to_visit);
+    if (!wide_tree4.empty()) return traverseWide(wide_tree4, ray, to_visit);
+
+    PerfCounters::Traversal count;
 
     double t;
     Intersection intersect;
     if (linear_tree[0].BB.intersect(ray, t))
     {
+        LinearNode::NodeIntersection hits[max_branching];
+
         uint32_t node_idx = 0;
-        while (true)
+        do
         {
             const auto &node = linear_tree[node_idx];
+            count.nodes++;
             if (node.num_surfaces)
             {
-                uint32_t end_idx = node.start_surface + node.num_surfaces;
-                for (uint32_t i = node.start_surface; i < end_idx; i++)
-                {
-                    Intersection t_intersect;
-                    if (ordered_surfaces[i]->intersect(ray, t_intersect))
-                    {
-                        if (t_intersect.t < intersect.t)
-                        {
-                            intersect = t_intersect;
-                            intersect.surface = ordered_surfaces[i];
-                        }
-                    }
-                }
+                count.primitives += node.num_surfaces;
+                intersectLeaf(node.start_surface, node.num_surfaces, ray, intersect);
             }
             else
             {
+                size_t num_hits = 0;
                 uint32_t child_idx = node_idx + 1;
                 while (child_idx != 0)
                 {
                     if (linear_tree[child_idx].BB.intersect(ray, t) && t < intersect.t)
                     {
-                        to_visit.push({ t, child_idx });
+                        hits[num_hits++] = { t, child_idx };
                     }
                     child_idx = linear_tree[child_idx].next_sibling;
                 }
+                pushOrdered(to_visit, hits, num_hits);
             }
-            if (to_visit.empty() || to_visit.top().t >= intersect.t)
-            {
-                break;
-            }
-            node_idx = to_visit.top().node; 
-            to_visit.pop();
-        }
+        } while (popNext(to_visit, intersect.t, node_idx));
     }
     return intersect;
 }
 
-void BVH::recursiveBuildFromOctree(const Octree<SurfaceCentroid> &octree_node, std::shared_ptr<BuildNode> bvh_node)
+/*****************************************************************************
+ Ordered traversal of the wide tree. Queue entries reference a lane of a wide
+ node (node index * W + lane), which either is a leaf or points to the next 
+ wide node to test.
+******************************************************************************/
+template<size_t W, class Queue>
+Intersection BVH::traverseWide(const std::vector<WideNode<W>> &wide_tree, const Ray& ray, Queue& to_visit) const
 {
-    bvh_node->df_idx = df_idx++;
+    const WideRay wide_ray(ray);
+    alignas(32) float t_entry[W];
+    LinearNode::NodeIntersection hits[W];
 
-    BoundingBox BB;
-
-    if (octree_node.leaf())
+    PerfCounters::Traversal count;
+    Intersection intersect;
+    uint32_t node_idx = 0;
+    while (true)
     {
-        bvh_node->surfaces.resize(octree_node.data_vec.size());
-        for (size_t i = 0; i < bvh_node->surfaces.size(); i++)
+        float t_max = intersect.t < std::numeric_limits<float>::max() ? 
+                      static_cast<float>(intersect.t) : std::numeric_limits<float>::infinity();
+
+        uint32_t hit_mask = wide_tree[node_idx].intersect(wide_ray, t_max, t_entry);
+        count.nodes++;
+
+        size_t num_hits = 0;
+        while (hit_mask)
         {
-            bvh_node->surfaces[i] = octree_node.data_vec[i].surface;
-            BB.merge(bvh_node->surfaces[i]->BB());
+            uint32_t lane = std::countr_zero(hit_mask);
+            hits[num_hits++] = { t_entry[lane], node_idx * static_cast<uint32_t>(W) + lane };
+            hit_mask &= hit_mask - 1;
         }
-    }
-    else
-    {
-        size_t num_children = 0;
-        for (size_t i = 0; i < octree_node.octants.size(); i++)
+        pushOrdered(to_visit, hits, num_hits);
+
+        while (true)
         {
-            if (!(octree_node.octants[i]->leaf() && octree_node.octants[i]->data_vec.empty()))
+            uint32_t lane_ref;
+            if (!popNext(to_visit, intersect.t, lane_ref))
             {
-                num_children++;
-                std::shared_ptr<BuildNode> child = std::make_shared<BuildNode>();
-                bvh_node->children.push_back(child);
-                recursiveBuildFromOctree(*octree_node.octants[i], child);
-                BB.merge(child->BB);
+                return intersect;
+            }
+            const auto &parent = wide_tree[lane_ref / W];
+            uint32_t lane = lane_ref % W;
+
+            if (parent.num_surfaces[lane])
+            {
+                count.primitives += parent.num_surfaces[lane];
+                intersectLeaf(parent.child[lane], parent.num_surfaces[lane], ray, intersect);
+            }
+            else
+            {
+                node_idx = parent.child[lane];
+                break;
             }
         }
-        branching[num_children]++;
     }
-    bvh_node->BB = BB;
 }
 
-void BVH::recursiveBuildBinarySAH(std::shared_ptr<BuildNode> bvh_node)
+/*****************************************************************************
+ Any-hit traversal for shadow rays. Nodes are visited in arbitrary order and
+ the traversal stops at the first intersection found before t_max.
+******************************************************************************/
+bool BVH::occluded(const Ray& ray, double t_max, const Surface::Base* ignore) const
 {
-    bvh_node->df_idx = df_idx++;
+    if (!wide_tree8.empty()) return occludedWide(wide_tree8, ray, t_max, ignore);
+    if (!wide_tree4.empty()) return occludedWide(wide_tree4, ray, t_max, ignore);
 
-    auto &S = bvh_node->surfaces;
-
-    if (S.size() <= leaf_surfaces)
-    {
-        return;
-    }
+    thread_local std::vector<uint32_t> to_visit_levels[max_levels];
+    auto &to_visit = to_visit_levels[level]; to_visit.clear();
 
-    BoundingBox centroid_extent;
-    for (const auto &s : S)
+    double t;
+    if (!linear_tree[0].BB.intersect(ray, t) || t >= t_max)
     {
-        centroid_extent.merge(s->BB().centroid());
+        return false;
     }
-    glm::dvec3 extent_dims = centroid_extent.dimensions();
-
-    uint8_t split_axis = extent_dims.x > extent_dims.y ? 
-                        (extent_dims.x > extent_dims.z ? 0 : 2) : 
-                        (extent_dims.y > extent_dims.z ? 1 : 2);
 
-    if (extent_dims[split_axis] < C::EPSILON)
+    PerfCounters::Traversal count;
+    uint32_t node_idx = 0;
+    while (true)
     {
-        if (S.size() > max_leaf_surfaces)
+        const auto &node = linear_tree[node_idx];
+        count.nodes++;
+        if (node.num_surfaces)
+        {
+            count.primitives += node.num_surfaces;
+            if (occludedLeaf(node.start_surface, node.num_surfaces, ray, t_max, ignore))
+            {
+                return true;
+            }
+        }
+        else
         {
-            arbitrarySplit(bvh_node, 2);
-            for (const auto& child : bvh_node->children) recursiveBuildBinarySAH(child);
+            uint32_t child_idx = node_idx + 1;
+            while (child_idx != 0)
+            {
+                if (linear_tree[child_idx].BB.intersect(ray, t) && t < t_max)
+                {
+                    to_visit.push_back(child_idx);
+                }
+                child_idx = linear_tree[child_idx].next_sibling;
+            }
         }
-        return;
+        if (to_visit.empty())
+        {
+            return false;
+        }
+        node_idx = to_visit.back();
+        to_visit.pop_back();
     }
+}
 
-    auto getIdx = [&](const glm::dvec3 &centroid)
-    {
-        double f = (centroid[split_axis] - centroid_extent.min[split_axis]) / extent_dims[split_axis];
-        int idx = (int)glm::floor(f * bins_per_axis);
-        return glm::min(idx, bins_per_axis - 1);
-    };
-
-    std::vector<std::pair<size_t, BoundingBox>> bins(bins_per_axis, { 0, BoundingBox() });
-    for (const auto &s : S)
-    {
-        int idx = getIdx(s->BB().centroid());
-        bins[idx].first++;
-        bins[idx].second.merge(s->BB());
-    }
+template<size_t W>
+bool BVH::occludedWide(const std::vector<WideNode<W>> &wide_tree, const Ray& ray, double t_max, const Surface::Base* ignore) const
+{
+    thread_local std::vector<uint32_t> to_visit_levels[max_levels];
+    auto &to_visit = to_visit_levels[level]; to_visit.clear();
 
-    std::shared_ptr<BuildNode> A = std::make_shared<BuildNode>();
-    std::shared_ptr<BuildNode> B = std::make_shared<BuildNode>();
+    const WideRay wide_ray(ray);
+    alignas(32) float t_entry[W];
 
-    double min_cost = std::numeric_limits<double>::max();
-    size_t split_bin = 0;
+    float t_max_f = t_max < std::numeric_limits<float>::max() ?
+                    static_cast<float>(t_max) : std::numeric_limits<float>::infinity();
 
-    for (size_t i = 0; i < bins_per_axis - 1; i++)
+    PerfCounters::Traversal count;
+    uint32_t node_idx = 0;
+    while (true)
     {
-        size_t A_count = 0;
-        BoundingBox A_BB;
-        for (size_t j = 0; j < i + 1; j++)
+        const auto &node = wide_tree[node_idx];
+        uint32_t hit_mask = node.intersect(wide_ray, t_max_f, t_entry);
+        count.nodes++;
+        while (hit_mask)
         {
-            A_count += bins[j].first;
-            A_BB.merge(bins[j].second);
+            uint32_t lane = std::countr_zero(hit_mask);
+            if (node.num_surfaces[lane])
+            {
+                count.primitives += node.num_surfaces[lane];
+                if (occludedLeaf(node.child[lane], node.num_surfaces[lane], ray, t_max, ignore))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                to_visit.push_back(node.child[lane]);
+            }
+            hit_mask &= hit_mask - 1;
         }
-
-        size_t B_count = 0;
-        BoundingBox B_BB;
-        for (size_t j = i + 1; j < bins_per_axis; j++)
+        if (to_visit.empty())
         {
-            B_count += bins[j].first;
-            B_BB.merge(bins[j].second);
+            return false;
         }
+        node_idx = to_visit.back();
+        to_visit.pop_back();
+    }
+}
 
-        double cost = 1.0 + (A_count * A_BB.area() + B_count * B_BB.area()) / bvh_node->BB.area();
-
-        if (cost < min_cost)
+bool BVH::occludedLeaf(uint32_t start_surface, uint8_t num_surfaces, const Ray& ray, double t_max, const Surface::Base* ignore) const
+{
+    uint32_t end_idx = start_surface + num_surfaces;
+    for (uint32_t i = start_surface; i < end_idx; i++)
+    {
+        const auto &p = ordered_primitives[i];
+        if (p.surface != ignore && p.surface->occludes(ray, p.index, t_max))
         {
-            split_bin = i;
-            min_cost = cost;
+            return true;
         }
     }
+    return false;
+}
 
-    if (min_cost > S.size())
+/*****************************************************************************
+ The priority queue orders the nodes itself. The stack is instead ordered by
+ pushing the child nodes sorted by decreasing entry distance, which makes the
+ nearest child the next node to visit.
+******************************************************************************/
+template<class Queue>
+void BVH::pushOrdered(Queue& to_visit, LinearNode::NodeIntersection* hits, size_t num_hits)
+{
+    if constexpr (std::is_same_v<Queue, TraversalStack>)
     {
-        if (S.size() > max_leaf_surfaces)
+        // Insertion sort, there are at most 8 children
+        for (size_t i = 1; i < num_hits; i++)
         {
-            arbitrarySplit(bvh_node, 2);
-            for (const auto& child : bvh_node->children) recursiveBuildBinarySAH(child);
+            auto hit = hits[i];
+            size_t j = i;
+            for (; j > 0 && hits[j - 1].t < hit.t; j--)
+            {
+                hits[j] = hits[j - 1];
+            }
+            hits[j] = hit;
         }
-        return;
     }
+    for (size_t i = 0; i < num_hits; i++)
+    {
+        to_visit.push(hits[i]);
+    }
+}
 
-    for (const auto &s : S)
+/*****************************************************************************
+ Returns the next node that can contain an intersection closer than t_max, or
+ false if there is none. The priority queue can stop at the first node that 
+ is too far away, while the stack has to skip it and continue.
+******************************************************************************/
+template<class Queue>
+bool BVH::popNext(Queue& to_visit, double t_max, uint32_t& node)
+{
+    while (!to_visit.empty())
     {
-        int idx = getIdx(s->BB().centroid());
-        if (idx <= split_bin)
+        const auto &top = to_visit.top();
+        if (top.t < t_max)
         {
-            A->surfaces.push_back(s);
-            A->BB.merge(s->BB());
+            node = top.node;
+            to_visit.pop();
+            return true;
         }
-        else
+        if constexpr (std::is_same_v<Queue, TraversalQueue>)
         {
-            B->surfaces.push_back(s);
-            B->BB.merge(s->BB());
+            return false;
         }
+        to_visit.pop();
     }
+    return false;
+}
 
-    S.clear();
-   
-    size_t num_children = 0;
-
-    if (!A->surfaces.empty())
-    {
-        num_children++;
-        bvh_node->children.push_back(A);
-        recursiveBuildBinarySAH(A);
-    }
-    if (!B->surfaces.empty())
+void BVH::intersectLeaf(uint32_t start_surface, uint8_t num_surfaces, const Ray& ray, Intersection& intersect) const
+{
+    uint32_t end_idx = start_surface + num_surfaces;
+    for (uint32_t i = start_surface; i < end_idx; i++)
     {
-        num_children++;
-        bvh_node->children.push_back(B);
-        recursiveBuildBinarySAH(B);
+        const auto &p = ordered_primitives[i];
+        Intersection t_intersect;
+        if (p.surface->intersect(ray, p.index, t_intersect))
+        {
+            if (t_intersect.t < intersect.t)
+            {
+                intersect = t_intersect;
+                intersect.surface = p.surface;
+            }
+        }
     }
-
-    branching[num_children]++;
 }
 
-void BVH::recursiveBuildQuaternarySAH(std::shared_ptr<BuildNode> bvh_node)
+/*****************************************************************************
+ Builds the top of the tree on the calling thread, with the binning of large
+ nodes split between all threads. Subtrees with fewer than task_size
+ primitives are deferred and then built in parallel, largest first. Subtrees
+ cover disjoint ranges of ordered_primitives, so the threads never touch the
+ same data. The resulting tree does not depend on the number of threads.
+******************************************************************************/
+void BVH::buildParallel(BuildNode* root, BuildMethod method, std::vector<BuildThread> &threads)
 {
-    bvh_node->df_idx = df_idx++;
-
-    glm::ivec2 num_bins(bins_per_axis);
+    std::vector<BuildTask> tasks;
 
-    auto &S = bvh_node->surfaces;
+    threads[0].tasks = threads.size() > 1 ? &tasks : nullptr;
+    build(root, method, threads[0]);
+    threads[0].tasks = nullptr;
 
-    if (S.size() <= leaf_surfaces)
+    if (tasks.empty())
     {
         return;
     }
 
-    BoundingBox centroid_extent;
-    for (const auto &s : S)
+    std::sort(tasks.begin(), tasks.end(), [](const BuildTask &a, const BuildTask &b)
     {
-        centroid_extent.merge(s->BB().centroid());
-    }
-    glm::dvec3 extent_dims = centroid_extent.dimensions();
+        return a.node->size() > b.node->size();
+    });
 
-    glm::ivec2 axes = extent_dims.x > extent_dims.y ?
-                     (extent_dims.y > extent_dims.z ? glm::ivec2(0, 1) : glm::ivec2(0, 2)) :
-                     (extent_dims.x > extent_dims.z ? glm::ivec2(0, 1) : glm::ivec2(1, 2));
-    
-    if (extent_dims[axes.x] < C::EPSILON || extent_dims[axes.y] < C::EPSILON)
+    WorkQueue<BuildTask> work_queue(tasks);
+
+    std::vector<std::unique_ptr<std::thread>> workers(threads.size());
+    for (size_t i = 0; i < workers.size(); i++)
     {
-        df_idx--;
-        recursiveBuildBinarySAH(bvh_node);
-        return;
+        workers[i] = std::make_unique<std::thread>([this, &work_queue, &thread = threads[i]]()
+        {
+            BuildTask task;
+            while (work_queue.getWork(task))
+            {
+                build(task.node, task.method, thread);
+            }
+        });
     }
 
-    glm::dvec2 axes_min(centroid_extent.min[axes.x], centroid_extent.min[axes.y]);
-    glm::dvec2 axes_dim(extent_dims[axes.x], extent_dims[axes.y]);
+    for (auto &worker : workers)
+    {
+        worker->join();
+    }
+}
 
-    auto getIdx = [&](const glm::dvec3 &centroid)
+void BVH::build(BuildNode* bvh_node, BuildMethod method, BuildThread &thread)
+{
+    if (thread.tasks && bvh_node->size() < task_size)
+    {
+        thread.tasks->push_back({ bvh_node, method });
+        return;
+    }
+
+    switch (method)
+    {
+        case BuildMethod::BINARY_SAH: recursiveBuildBinarySAH(bvh_node, thread); break;
+        case BuildMethod::QUATERNARY_SAH: recursiveBuildQuaternarySAH(bvh_node, thread); break;
+        case BuildMethod::LBVH: recursiveBuildLBVH(bvh_node, thread); break;
+    }
+}
+
+template<class F>
+void BVH::parallelChunks(size_t begin, size_t end, F f) const
+{
+    if (num_build_threads == 1)
+    {
+        f(0, begin, end);
+        return;
+    }
+
+    std::vector<std::unique_ptr<std::thread>> workers(num_build_threads);
+
+    size_t chunk_size = (end - begin + num_build_threads - 1) / num_build_threads;
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        size_t chunk_begin = std::min(begin + i * chunk_size, end);
+        size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+        workers[i] = std::make_unique<std::thread>([&f, i, chunk_begin, chunk_end]()
+        {
+            f(i, chunk_begin, chunk_end);
+        });
+    }
+
+    for (auto &worker : workers)
+    {
+        worker->join();
+    }
+}
+
+template<class T, class Reduce, class Merge>
+T BVH::parallelReduce(const BuildNode* bvh_node, const BuildThread &thread, Reduce reduce, Merge merge) const
+{
+    // Spawning threads only pays off for large nodes
+    constexpr uint32_t min_parallel_size = 1 << 16;
+
+    if (!thread.tasks || bvh_node->size() < min_parallel_size)
+    {
+        return reduce(bvh_node->begin, bvh_node->end);
+    }
+
+    std::vector<T> results(num_build_threads);
+    parallelChunks(bvh_node->begin, bvh_node->end, [&](size_t chunk, size_t begin, size_t end)
+    {
+        results[chunk] = reduce((uint32_t)begin, (uint32_t)end);
+    });
+
+    // Merged in chunk order to give the same result as a single reduce
+    for (size_t i = 1; i < results.size(); i++)
+    {
+        merge(results[0], results[i]);
+    }
+    return results[0];
+}
+
+void BVH::recursiveBuildFromOctree(const Octree<PrimitiveCentroid> &octree_node, BuildNode* bvh_node, BuildThread &thread)
+{
+    BoundingBox BB;
+
+    bvh_node->begin = (uint32_t)ordered_primitives.size();
+
+    if (octree_node.leaf())
+    {
+        for (const auto &data : octree_node.data_vec)
+        {
+            ordered_primitives.push_back(data.primitive);
+            BB.merge(primitiveBB(data.primitive));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < octree_node.octants.size(); i++)
+        {
+            if (!(octree_node.octants[i]->leaf() && octree_node.octants[i]->data_vec.empty()))
+            {
+                BuildNode* child = thread.newNode();
+                bvh_node->children.push_back(child);
+                recursiveBuildFromOctree(*octree_node.octants[i], child, thread);
+                BB.merge(child->BB);
+            }
+        }
+    }
+
+    bvh_node->end = (uint32_t)ordered_primitives.size();
+    bvh_node->BB = BB;
+}
+
+void BVH::recursiveBuildBinarySAH(BuildNode* bvh_node, BuildThread &thread)
+{
+    if (bvh_node->size() <= leaf_surfaces)
+    {
+        return;
+    }
+
+    BoundingBox centroid_extent = parallelReduce<BoundingBox>(bvh_node, thread,
+        [this](uint32_t begin, uint32_t end)
+        {
+            BoundingBox extent;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                extent.merge(primitiveBB(ordered_primitives[i]).centroid());
+            }
+            return extent;
+        },
+        [](BoundingBox &a, const BoundingBox &b) { a.merge(b); }
+    );
+    glm::dvec3 extent_dims = centroid_extent.dimensions();
+
+    uint8_t split_axis = extent_dims.x > extent_dims.y ?
+                        (extent_dims.x > extent_dims.z ? 0 : 2) :
+                        (extent_dims.y > extent_dims.z ? 1 : 2);
+
+    if (extent_dims[split_axis] < C::EPSILON)
+    {
+        if (bvh_node->size() > max_leaf_surfaces)
+        {
+            arbitrarySplit(bvh_node, 2, thread);
+            for (const auto& child : bvh_node->children) build(child, BuildMethod::BINARY_SAH, thread);
+        }
+        return;
+    }
+
+    auto getIdx = [&](const glm::dvec3 &centroid)
+    {
+        double f = (centroid[split_axis] - centroid_extent.min[split_axis]) / extent_dims[split_axis];
+        int idx = (int)glm::floor(f * bins_per_axis);
+        return glm::min(idx, bins_per_axis - 1);
+    };
+
+    typedef std::vector<std::pair<size_t, BoundingBox>> Bins;
+
+    Bins bins = parallelReduce<Bins>(bvh_node, thread,
+        [&](uint32_t begin, uint32_t end)
+        {
+            Bins bins(bins_per_axis, { 0, BoundingBox() });
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const auto &BB = primitiveBB(ordered_primitives[i]);
+                int idx = getIdx(BB.centroid());
+                bins[idx].first++;
+                bins[idx].second.merge(BB);
+            }
+            return bins;
+        },
+        [](Bins &a, const Bins &b)
+        {
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                a[i].first += b[i].first;
+                a[i].second.merge(b[i].second);
+            }
+        }
+    );
+
+    double min_cost = std::numeric_limits<double>::max();
+    size_t split_bin = 0;
+
+    for (size_t i = 0; i < bins_per_axis - 1; i++)
+    {
+        size_t A_count = 0;
+        BoundingBox A_BB;
+        for (size_t j = 0; j < i + 1; j++)
+        {
+            A_count += bins[j].first;
+            A_BB.merge(bins[j].second);
+        }
+
+        size_t B_count = 0;
+        BoundingBox B_BB;
+        for (size_t j = i + 1; j < bins_per_axis; j++)
+        {
+            B_count += bins[j].first;
+            B_BB.merge(bins[j].second);
+        }
+
+        double cost = 1.0 + (A_count * A_BB.area() + B_count * B_BB.area()) / bvh_node->BB.area();
+
+        if (cost < min_cost)
+        {
+            split_bin = i;
+            min_cost = cost;
+        }
+    }
+
+    if (min_cost > bvh_node->size())
+    {
+        if (bvh_node->size() > max_leaf_surfaces)
+        {
+            arbitrarySplit(bvh_node, 2, thread);
+            for (const auto& child : bvh_node->children) build(child, BuildMethod::BINARY_SAH, thread);
+        }
+        return;
+    }
+
+    // Partition in place, the children then cover consecutive ranges of the parent range
+    auto first = ordered_primitives.begin();
+    auto mid = std::partition(first + bvh_node->begin, first + bvh_node->end, [&](const Primitive &p)
+    {
+        return getIdx(primitiveBB(p).centroid()) <= split_bin;
+    });
+
+    BuildNode* A = thread.newNode();
+    A->begin = bvh_node->begin;
+    A->end = (uint32_t)(mid - first);
+
+    BuildNode* B = thread.newNode();
+    B->begin = A->end;
+    B->end = bvh_node->end;
+
+    for (size_t i = 0; i < bins_per_axis; i++)
+    {
+        (i <= split_bin ? A : B)->BB.merge(bins[i].second);
+    }
+
+    for (BuildNode* child : { A, B })
+    {
+        if (child->size())
+        {
+            bvh_node->children.push_back(child);
+        }
+    }
+
+    for (const auto &child : bvh_node->children)
+    {
+        build(child, BuildMethod::BINARY_SAH, thread);
+    }
+}
+
+void BVH::recursiveBuildQuaternarySAH(BuildNode* bvh_node, BuildThread &thread)
+{
+    glm::ivec2 num_bins(bins_per_axis);
+
+    if (bvh_node->size() <= leaf_surfaces)
+    {
+        return;
+    }
+
+    BoundingBox centroid_extent = parallelReduce<BoundingBox>(bvh_node, thread,
+        [this](uint32_t begin, uint32_t end)
+        {
+            BoundingBox extent;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                extent.merge(primitiveBB(ordered_primitives[i]).centroid());
+            }
+            return extent;
+        },
+        [](BoundingBox &a, const BoundingBox &b) { a.merge(b); }
+    );
+    glm::dvec3 extent_dims = centroid_extent.dimensions();
+
+    glm::ivec2 axes = extent_dims.x > extent_dims.y ?
+                     (extent_dims.y > extent_dims.z ? glm::ivec2(0, 1) : glm::ivec2(0, 2)) :
+                     (extent_dims.x > extent_dims.z ? glm::ivec2(0, 1) : glm::ivec2(1, 2));
+
+    if (extent_dims[axes.x] < C::EPSILON || extent_dims[axes.y] < C::EPSILON)
+    {
+        recursiveBuildBinarySAH(bvh_node, thread);
+        return;
+    }
+
+    glm::dvec2 axes_min(centroid_extent.min[axes.x], centroid_extent.min[axes.y]);
+    glm::dvec2 axes_dim(extent_dims[axes.x], extent_dims[axes.y]);
+
+    auto getIdx = [&](const glm::dvec3 &centroid)
     {
         glm::dvec2 f = (glm::dvec2(centroid[axes.x], centroid[axes.y]) - axes_min) / axes_dim;
         glm::ivec2 idx = glm::floor(f * glm::dvec2(num_bins));
         return glm::min(idx, num_bins - 1);
     };
 
-    std::vector<std::vector<std::pair<size_t, BoundingBox>>> bins(num_bins.x,
-        std::vector<std::pair<size_t, BoundingBox>>(num_bins.y, { 0, BoundingBox() })
-    );
+    typedef std::vector<std::vector<std::pair<size_t, BoundingBox>>> Bins;
+
+    Bins bins = parallelReduce<Bins>(bvh_node, thread,
+        [&](uint32_t begin, uint32_t end)
+        {
+            Bins bins(num_bins.x, std::vector<std::pair<size_t, BoundingBox>>(num_bins.y, { 0, BoundingBox() }));
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const auto &BB = primitiveBB(ordered_primitives[i]);
+                glm::ivec2 idx = getIdx(BB.centroid());
+                bins[idx.x][idx.y].first++;
+                bins[idx.x][idx.y].second.merge(BB);
+            }
+            return bins;
+        },
+        [](Bins &a, const Bins &b)
+        {
+            for (size_t x = 0; x < a.size(); x++)
+            {
+                for (size_t y = 0; y < a[x].size(); y++)
+                {
+                    a[x][y].first += b[x][y].first;
+                    a[x][y].second.merge(b[x][y].second);
+                }
+            }
+        }
+    );
+
+    // Bounding boxes and primitive counts of the four quadrants of split (i, j)
+    auto quadrants = [&](size_t i, size_t j, std::vector<BoundingBox> &BBs, std::vector<size_t> &counts)
+    {
+        BBs = std::vector<BoundingBox>(4, BoundingBox());
+        counts = std::vector<size_t>(4, 0);
+
+        for (uint8_t v = 0b00; v <= 0b11; v++)
+        {
+            std::vector<glm::ivec2> range(2, glm::ivec2(0));
+            range[0] = v & 0b01 ? glm::ivec2(i + 1, num_bins.x) : glm::ivec2(0, i + 1);
+            range[1] = v & 0b10 ? glm::ivec2(j + 1, num_bins.y) : glm::ivec2(0, j + 1);
+
+            for (size_t x = range[0][0]; x < range[0][1]; x++)
+            {
+                for (size_t y = range[1][0]; y < range[1][1]; y++)
+                {
+                    counts[v] += bins[x][y].first;
+                    BBs[v].merge(bins[x][y].second);
+                }
+            }
+        }
+    };
+
+    double min_cost = std::numeric_limits<double>::max();
+    glm::ivec2 split_bin(0);
+
+    std::vector<BoundingBox> BBs;
+    std::vector<size_t> counts;
+
+    for (size_t i = 0; i < num_bins.x - 1; i++)
+    {
+        for (size_t j = 0; j < num_bins.y - 1; j++)
+        {
+            quadrants(i, j, BBs, counts);
+
+            double cost = 0.0;
+            for (uint8_t v = 0b00; v <= 0b11; v++)
+            {
+                cost += BBs[v].area() * counts[v];
+            }
+
+            cost = 1.0 + cost / bvh_node->BB.area();
+
+            if (cost < min_cost)
+            {
+                split_bin = glm::ivec2(i, j);
+                min_cost = cost;
+            }
+        }
+    }
+
+    if (min_cost > bvh_node->size())
+    {
+        if (bvh_node->size() > max_leaf_surfaces)
+        {
+            arbitrarySplit(bvh_node, 4, thread);
+            for (const auto& child : bvh_node->children) build(child, BuildMethod::QUATERNARY_SAH, thread);
+        }
+        return;
+    }
+
+    // Partition in place into quadrant order 0b00, 0b01, 0b10, 0b11, i.e. first
+    // on the second axis and then each half on the first axis.
+    auto first = ordered_primitives.begin();
+    auto mid = std::partition(first + bvh_node->begin, first + bvh_node->end, [&](const Primitive &p)
+    {
+        return getIdx(primitiveBB(p).centroid()).y <= split_bin.y;
+    });
+    auto onFirstSide = [&](const Primitive &p)
+    {
+        return getIdx(primitiveBB(p).centroid()).x <= split_bin.x;
+    };
+    std::partition(first + bvh_node->begin, mid, onFirstSide);
+    std::partition(mid, first + bvh_node->end, onFirstSide);
+
+    quadrants(split_bin.x, split_bin.y, BBs, counts);
+
+    uint32_t begin = bvh_node->begin;
+    for (uint8_t v = 0b00; v <= 0b11; v++)
+    {
+        if (counts[v])
+        {
+            BuildNode* child = thread.newNode();
+            child->begin = begin;
+            child->end = begin + (uint32_t)counts[v];
+            child->BB = BBs[v];
+            bvh_node->children.push_back(child);
+            begin = child->end;
+        }
+    }
+
+    for (const auto &child : bvh_node->children)
+    {
+        build(child, BuildMethod::QUATERNARY_SAH, thread);
+    }
+}
+
+/*****************************************************************************
+ Binary SAH construction with spatial splits, from "Spatial Splits in Bounding
+ Volume Hierarchies" by Stich et al. Besides the binned object split, which
+ partitions the references, a binned spatial split is evaluated on each axis
+ if the children of the object split overlap. Spatial splits divide space 
+ rather than references, and references that straddle the split plane are 
+ clipped and duplicated into both children. This gives tighter nodes for long
+ and thin primitives, at the cost of more references. The tree is built by a 
+ single thread since the number of references of each subtree isn't known
+ beforehand, and leaves are appended to ordered_primitives in depth first order.
+******************************************************************************/
+void BVH::recursiveBuildSBVH(BuildNode* bvh_node, std::vector<Reference> &references, BuildThread &thread)
+{
+    auto &R = references;
+    size_t N = R.size();
+
+    auto makeLeaf = [&]()
+    {
+        bvh_node->begin = (uint32_t)ordered_primitives.size();
+        for (const auto &r : R)
+        {
+            ordered_primitives.push_back(r.primitive);
+        }
+        bvh_node->end = (uint32_t)ordered_primitives.size();
+    };
+
+    if (N <= leaf_surfaces)
+    {
+        makeLeaf();
+        return;
+    }
+
+    double node_area = bvh_node->BB.area();
+
+    typedef std::vector<std::pair<size_t, BoundingBox>> Bins;
+
+    // Sweeps the bins from both sides and returns the split after the bin with the lowest cost
+    auto sweep = [&](const Bins &enter, const Bins &exit, size_t &split_bin, BoundingBox &A_BB, BoundingBox &B_BB)
+    {
+        std::vector<BoundingBox> B_BBs(bins_per_axis);
+        std::vector<size_t> B_counts(bins_per_axis, 0);
+        for (int i = bins_per_axis - 1; i > 0; i--)
+        {
+            B_BBs[i] = i + 1 < bins_per_axis ? B_BBs[i + 1] : BoundingBox();
+            B_BBs[i].merge(exit[i].second);
+            B_counts[i] = (i + 1 < bins_per_axis ? B_counts[i + 1] : 0) + exit[i].first;
+        }
+
+        double min_cost = std::numeric_limits<double>::max();
+        size_t A_count = 0;
+        BoundingBox A_sweep;
+        for (size_t i = 0; i < bins_per_axis - 1; i++)
+        {
+            A_count += enter[i].first;
+            A_sweep.merge(enter[i].second);
+
+            if (!A_count || !B_counts[i + 1])
+            {
+                continue;
+            }
+
+            double cost = 1.0 + (A_count * A_sweep.area() + B_counts[i + 1] * B_BBs[i + 1].area()) / node_area;
+            if (cost < min_cost)
+            {
+                min_cost = cost;
+                split_bin = i;
+                A_BB = A_sweep;
+                B_BB = B_BBs[i + 1];
+            }
+        }
+        return min_cost;
+    };
+
+    // Object split
+    BoundingBox centroid_extent;
+    for (const auto &r : R)
+    {
+        centroid_extent.merge(r.BB.centroid());
+    }
+    glm::dvec3 extent_dims = centroid_extent.dimensions();
+
+    auto getIdx = [&](int axis, const glm::dvec3 &centroid)
+    {
+        double f = (centroid[axis] - centroid_extent.min[axis]) / extent_dims[axis];
+        int idx = (int)glm::floor(f * bins_per_axis);
+        return glm::min(idx, bins_per_axis - 1);
+    };
+
+    double object_cost = std::numeric_limits<double>::max();
+    int object_axis = -1;
+    size_t object_bin = 0;
+    BoundingBox object_A_BB, object_B_BB;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent_dims[axis] < C::EPSILON)
+        {
+            continue;
+        }
+
+        Bins bins(bins_per_axis, { 0, BoundingBox() });
+        for (const auto &r : R)
+        {
+            int idx = getIdx(axis, r.BB.centroid());
+            bins[idx].first++;
+            bins[idx].second.merge(r.BB);
+        }
+
+        size_t split_bin;
+        BoundingBox A_BB, B_BB;
+        double cost = sweep(bins, bins, split_bin, A_BB, B_BB);
+        if (cost < object_cost)
+        {
+            object_cost = cost;
+            object_axis = axis;
+            object_bin = split_bin;
+            object_A_BB = A_BB;
+            object_B_BB = B_BB;
+        }
+    }
+
+    // Spatial split
+    BoundingBox overlap = object_A_BB;
+    overlap.clip(object_B_BB);
+
+    double spatial_cost = std::numeric_limits<double>::max();
+    int spatial_axis = -1;
+    double spatial_position = 0.0;
+    size_t spatial_references = 0;
+    BoundingBox spatial_A_BB, spatial_B_BB;
+
+    if (num_references < max_references && (object_axis == -1 || overlap.area() > spatial_split_alpha * root_area))
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            double min = bvh_node->BB.min[axis];
+            double extent = bvh_node->BB.max[axis] - min;
+            if (extent < C::EPSILON)
+            {
+                continue;
+            }
+
+            auto getBin = [&](double x)
+            {
+                return std::clamp((int)((x - min) / extent * bins_per_axis), 0, bins_per_axis - 1);
+            };
+            auto binPosition = [&](int bin)
+            {
+                return min + extent * bin / bins_per_axis;
+            };
+
+            // References are counted in the bins they enter and exit, and bounded in all bins they overlap
+            Bins enter(bins_per_axis, { 0, BoundingBox() });
+            Bins exit(bins_per_axis, { 0, BoundingBox() });
+            for (const auto &r : R)
+            {
+                int first = getBin(r.BB.min[axis]);
+                int last = getBin(r.BB.max[axis]);
+                enter[first].first++;
+                exit[last].first++;
+
+                BoundingBox remaining = r.BB;
+                for (int bin = first; bin < last; bin++)
+                {
+                    BoundingBox left, right;
+                    r.primitive.surface->splitPrimitive(r.primitive.index, remaining, axis, binPosition(bin + 1), left, right);
+                    enter[bin].second.merge(left);
+                    remaining = right;
+                }
+                enter[last].second.merge(remaining);
+            }
+            for (int bin = 0; bin < bins_per_axis; bin++)
+            {
+                exit[bin].second = enter[bin].second;
+            }
+
+            size_t split_bin;
+            BoundingBox A_BB, B_BB;
+            double cost = sweep(enter, exit, split_bin, A_BB, B_BB);
+            if (cost < spatial_cost)
+            {
+                size_t A_count = 0, B_count = 0;
+                for (size_t bin = 0; bin < bins_per_axis; bin++)
+                {
+                    if (bin <= split_bin) A_count += enter[bin].first;
+                    else B_count += exit[bin].first;
+                }
+
+                spatial_cost = cost;
+                spatial_axis = axis;
+                spatial_position = binPosition((int)split_bin + 1);
+                spatial_references = A_count + B_count;
+                spatial_A_BB = A_BB;
+                spatial_B_BB = B_BB;
+            }
+        }
+    }
+
+    bool spatial_split = spatial_axis != -1 && spatial_cost < object_cost && 
+                         num_references + spatial_references - N <= max_references;
+
+    double min_cost = spatial_split ? spatial_cost : object_cost;
+
+    std::vector<Reference> A, B;
 
-    for (const auto &s : S)
+    if (min_cost > N || (!spatial_split && object_axis == -1))
     {
-        glm::ivec2 idx = getIdx(s->BB().centroid());
-        bins[idx.x][idx.y].first++;
-        bins[idx.x][idx.y].second.merge(s->BB());
+        if (N <= max_leaf_surfaces)
+        {
+            makeLeaf();
+            return;
+        }
+        for (size_t i = 0; i < N; i++)
+        {
+            (i % 2 ? B : A).push_back(R[i]);
+        }
     }
+    else if (spatial_split)
+    {
+        double A_area = spatial_A_BB.area(), B_area = spatial_B_BB.area();
+        size_t A_count = 0, B_count = 0;
+        for (const auto &r : R)
+        {
+            if (r.BB.max[spatial_axis] <= spatial_position) A_count++;
+            else if (r.BB.min[spatial_axis] >= spatial_position) B_count++;
+        }
 
-    double min_cost = std::numeric_limits<double>::max();
-    glm::ivec2 split_bin(0);
+        for (const auto &r : R)
+        {
+            if (r.BB.max[spatial_axis] <= spatial_position)
+            {
+                A.push_back(r);
+                continue;
+            }
+            if (r.BB.min[spatial_axis] >= spatial_position)
+            {
+                B.push_back(r);
+                continue;
+            }
 
-    for (size_t i = 0; i < num_bins.x - 1; i++)
+            // Reference unsplitting, a straddling reference is put in one child if that is cheaper than duplicating it
+            BoundingBox A_union = spatial_A_BB, B_union = spatial_B_BB;
+            A_union.merge(r.BB);
+            B_union.merge(r.BB);
+
+            double split_cost = A_area * (A_count + 1) + B_area * (B_count + 1);
+            double A_cost = A_union.area() * (A_count + 1) + B_area * B_count;
+            double B_cost = A_area * A_count + B_union.area() * (B_count + 1);
+
+            if (A_cost < split_cost && A_cost <= B_cost)
+            {
+                A.push_back(r);
+                A_count++;
+            }
+            else if (B_cost < split_cost)
+            {
+                B.push_back(r);
+                B_count++;
+            }
+            else
+            {
+                BoundingBox left, right;
+                r.primitive.surface->splitPrimitive(r.primitive.index, r.BB, spatial_axis, spatial_position, left, right);
+                if (left.valid())
+                {
+                    A.push_back({ r.primitive, left });
+                    A_count++;
+                }
+                if (right.valid())
+                {
+                    B.push_back({ r.primitive, right });
+                    B_count++;
+                }
+            }
+        }
+    }
+    else
     {
-        for (size_t j = 0; j < num_bins.y - 1; j++)
+        for (const auto &r : R)
         {
-            std::vector<BoundingBox> BBs(4, BoundingBox());
-            std::vector<size_t> counts(4, 0);
+            (getIdx(object_axis, r.BB.centroid()) <= object_bin ? A : B).push_back(r);
+        }
+    }
 
-            for (uint8_t v = 0b00; v <= 0b11; v++)
+    if (A.empty() || B.empty())
+    {
+        if (N <= max_leaf_surfaces)
+        {
+            makeLeaf();
+            return;
+        }
+        A.clear();
+        B.clear();
+        for (size_t i = 0; i < N; i++)
+        {
+            (i % 2 ? B : A).push_back(R[i]);
+        }
+    }
+
+    num_references += A.size() + B.size() - N;
+    R = std::vector<Reference>();
+
+    for (auto &child_references : { &A, &B })
+    {
+        BuildNode* child = thread.newNode();
+        for (const auto &r : *child_references)
+        {
+            child->BB.merge(r.BB);
+        }
+        bvh_node->children.push_back(child);
+        recursiveBuildSBVH(child, *child_references, thread);
+    }
+
+    bvh_node->begin = bvh_node->children.front()->begin;
+    bvh_node->end = bvh_node->children.back()->end;
+}
+
+// Spreads the lower 21 bits of x so that there are two zero bits between each bit
+static uint64_t expandBits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+/*****************************************************************************
+ Linear BVH construction. The primitives are sorted by the 63-bit Morton code
+ of their centroids, which places primitives that are close in space close 
+ in the array. The tree is then formed by recursively splitting the sorted
+ range where the highest differing bit of the codes changes, i.e. by the 
+ spatial median of the Morton grid cells. This is much faster to construct 
+ than the SAH methods since no split costs are evaluated.
+
+ If ploc_radius is positive, the leaves of the linear BVH are instead used as
+ the initial clusters of PLOC, which gives trees close to SAH quality.
+******************************************************************************/
+void BVH::buildLBVH(BuildNode* root, const std::vector<Primitive> &primitives, int ploc_radius, std::vector<BuildThread> &threads)
+{
+    size_t N = primitives.size();
+
+    std::vector<BoundingBox> chunk_extents(num_build_threads);
+    parallelChunks(0, N, [&](size_t chunk, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            chunk_extents[chunk].merge(primitiveBB(primitives[i]).centroid());
+        }
+    });
+
+    BoundingBox centroid_extent;
+    for (const auto &extent : chunk_extents)
+    {
+        centroid_extent.merge(extent);
+    }
+    glm::dvec3 extent_dims = glm::max(centroid_extent.dimensions(), glm::dvec3(C::EPSILON));
+
+    std::vector<uint64_t> codes(N);
+    std::vector<uint32_t> indices(N);
+    parallelChunks(0, N, [&](size_t /*chunk*/, size_t begin, size_t end)
+    {
+        constexpr double cells = 1 << 21;
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::dvec3 f = (primitiveBB(primitives[i]).centroid() - centroid_extent.min) / extent_dims;
+            glm::u64vec3 cell = glm::min(glm::u64vec3(glm::max(f, 0.0) * cells), glm::u64vec3(cells - 1));
+            codes[i] = expandBits(cell.x) << 2 | expandBits(cell.y) << 1 | expandBits(cell.z);
+            indices[i] = (uint32_t)i;
+        }
+    });
+
+    radixSort(codes, indices, 63);
+
+    ordered_primitives.resize(N);
+    parallelChunks(0, N, [&](size_t /*chunk*/, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            ordered_primitives[i] = primitives[indices[i]];
+        }
+    });
+
+    morton_codes = std::move(codes);
+    root->end = (uint32_t)N;
+    buildParallel(root, BuildMethod::LBVH, threads);
+    morton_codes = std::vector<uint64_t>();
+
+    refit(root);
+
+    if (ploc_radius > 0 && !root->leaf())
+    {
+        std::vector<BuildNode*> leaves;
+        std::vector<BuildNode*> to_visit{ root };
+        while (!to_visit.empty())
+        {
+            BuildNode* node = to_visit.back();
+            to_visit.pop_back();
+            if (node->leaf())
+            {
+                leaves.push_back(node);
+            }
+            else
             {
-                std::vector<glm::ivec2> range(2, glm::ivec2(0));
-                range[0] = v & 0b01 ? glm::ivec2(i + 1, num_bins.x) : glm::ivec2(0, i + 1);
-                range[1] = v & 0b10 ? glm::ivec2(j + 1, num_bins.y) : glm::ivec2(0, j + 1);
+                to_visit.insert(to_visit.end(), node->children.rbegin(), node->children.rend());
+            }
+        }
+        *root = *buildPLOC(leaves, ploc_radius, threads[0]);
+
+        // PLOC merges clusters that aren't adjacent in Morton order, so the primitives are 
+        // reordered by the depth-first order of the leaves to make every node range contiguous
+        std::vector<BuildNode*> nodes;
+        to_visit = { root };
+        while (!to_visit.empty())
+        {
+            BuildNode* node = to_visit.back();
+            to_visit.pop_back();
+            nodes.push_back(node);
+            to_visit.insert(to_visit.end(), node->children.rbegin(), node->children.rend());
+        }
+
+        std::vector<Primitive> reordered_primitives;
+        reordered_primitives.reserve(N);
+        for (BuildNode* node : nodes)
+        {
+            if (node->leaf())
+            {
+                uint32_t begin = (uint32_t)reordered_primitives.size();
+                reordered_primitives.insert(reordered_primitives.end(), 
+                                            ordered_primitives.begin() + node->begin, 
+                                            ordered_primitives.begin() + node->end);
+                node->begin = begin;
+                node->end = (uint32_t)reordered_primitives.size();
+            }
+        }
+        ordered_primitives = std::move(reordered_primitives);
+
+        for (auto node = nodes.rbegin(); node != nodes.rend(); node++)
+        {
+            if (!(*node)->leaf())
+            {
+                (*node)->begin = (*node)->children.front()->begin;
+                (*node)->end = (*node)->children.back()->end;
+            }
+        }
+    }
+}
+
+void BVH::recursiveBuildLBVH(BuildNode* bvh_node, BuildThread &thread)
+{
+    if (bvh_node->size() <= leaf_surfaces)
+    {
+        for (uint32_t i = bvh_node->begin; i < bvh_node->end; i++)
+        {
+            bvh_node->BB.merge(primitiveBB(ordered_primitives[i]));
+        }
+        return;
+    }
+
+    uint32_t split;
+    uint64_t difference = morton_codes[bvh_node->begin] ^ morton_codes[bvh_node->end - 1];
+    if (difference)
+    {
+        int bit = 63 - std::countl_zero(difference);
+        auto first = morton_codes.begin();
+        split = (uint32_t)(std::partition_point(first + bvh_node->begin, first + bvh_node->end, [bit](uint64_t code)
+        {
+            return !((code >> bit) & 1);
+        }) - first);
+    }
+    else // All codes are equal
+    {
+        split = bvh_node->begin + bvh_node->size() / 2;
+    }
+
+    BuildNode* A = thread.newNode();
+    A->begin = bvh_node->begin;
+    A->end = split;
+
+    BuildNode* B = thread.newNode();
+    B->begin = split;
+    B->end = bvh_node->end;
 
-                for (size_t x = range[0][0]; x < range[0][1]; x++)
+    bvh_node->children = { A, B };
+
+    build(A, BuildMethod::LBVH, thread);
+    build(B, BuildMethod::LBVH, thread);
+}
+
+/*****************************************************************************
+ PLOC, from "Parallel Locally-Ordered Clustering for Bounding Volume Hierarchy
+ Construction" by Meister and Bittner. Each cluster searches the clusters 
+ within radius positions in Morton order for the one that gives the smallest
+ merged bounding box. Mutual nearest neighbors are then merged into a new 
+ cluster, and this is repeated until only the root cluster is left. The 
+ nearest neighbor search is split between all threads.
+******************************************************************************/
+BVH::BuildNode* BVH::buildPLOC(std::vector<BuildNode*> clusters, int radius, BuildThread &thread)
+{
+    std::vector<uint32_t> nearest;
+    while (clusters.size() > 1)
+    {
+        size_t N = clusters.size();
+        nearest.resize(N);
+
+        parallelChunks(0, N, [&](size_t /*chunk*/, size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                double min_area = std::numeric_limits<double>::max();
+                size_t first = i > (size_t)radius ? i - radius : 0;
+                size_t last = std::min(i + radius, N - 1);
+                for (size_t j = first; j <= last; j++)
                 {
-                    for (size_t y = range[1][0]; y < range[1][1]; y++)
+                    if (j == i) continue;
+
+                    BoundingBox BB = clusters[i]->BB;
+                    BB.merge(clusters[j]->BB);
+                    double area = BB.area();
+                    if (area < min_area)
                     {
-                        counts[v] += bins[x][y].first;
-                        BBs[v].merge(bins[x][y].second);
+                        min_area = area;
+                        nearest[i] = (uint32_t)j;
                     }
                 }
             }
+        });
 
-            double cost = 0.0;
-            for (uint8_t v = 0b00; v <= 0b11; v++)
+        std::vector<BuildNode*> merged;
+        merged.reserve(N);
+        for (uint32_t i = 0; i < N; i++)
+        {
+            uint32_t j = nearest[i];
+            if (nearest[j] != i)
             {
-                cost += BBs[v].area() * counts[v];
+                merged.push_back(clusters[i]);
+            }
+            else if (i < j)
+            {
+                BuildNode* node = thread.newNode();
+                node->children = { clusters[i], clusters[j] };
+                node->BB = clusters[i]->BB;
+                node->BB.merge(clusters[j]->BB);
+                merged.push_back(node);
+            }
+        }
+        clusters = std::move(merged);
+    }
+    return clusters[0];
+}
+
+/*****************************************************************************
+ Parallel LSD radix sort of keys and values, 8 bits per pass. Each thread 
+ counts the digits in its chunk, and the counts are then turned into scatter 
+ offsets per chunk and digit, which keeps the sort stable.
+******************************************************************************/
+void BVH::radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, int bits) const
+{
+    constexpr size_t radix = 256;
+
+    size_t N = keys.size();
+    std::vector<uint64_t> sorted_keys(N);
+    std::vector<uint32_t> sorted_values(N);
+    std::vector<std::array<size_t, radix>> offsets(num_build_threads);
+
+    for (int shift = 0; shift < bits; shift += 8)
+    {
+        parallelChunks(0, N, [&](size_t chunk, size_t begin, size_t end)
+        {
+            auto &count = offsets[chunk];
+            count.fill(0);
+            for (size_t i = begin; i < end; i++)
+            {
+                count[(keys[i] >> shift) & 0xFF]++;
             }
+        });
 
-            cost = 1.0 + cost / bvh_node->BB.area();
+        size_t sum = 0;
+        for (size_t digit = 0; digit < radix; digit++)
+        {
+            for (auto &offset : offsets)
+            {
+                size_t count = offset[digit];
+                offset[digit] = sum;
+                sum += count;
+            }
+        }
 
-            if (cost < min_cost)
+        parallelChunks(0, N, [&](size_t chunk, size_t begin, size_t end)
+        {
+            auto &offset = offsets[chunk];
+            for (size_t i = begin; i < end; i++)
             {
-                split_bin = glm::ivec2(i, j);
-                min_cost = cost;
+                size_t idx = offset[(keys[i] >> shift) & 0xFF]++;
+                sorted_keys[idx] = keys[i];
+                sorted_values[idx] = values[i];
             }
+        });
+
+        std::swap(keys, sorted_keys);
+        std::swap(values, sorted_values);
+    }
+}
+
+// Computes the bounding boxes of inner nodes from their children
+void BVH::refit(BuildNode* bvh_node)
+{
+    if (bvh_node->leaf())
+    {
+        return;
+    }
+
+    bvh_node->BB = BoundingBox();
+    for (const auto &child : bvh_node->children)
+    {
+        refit(child);
+        bvh_node->BB.merge(child->BB);
+    }
+}
+
+// Assigns depth first indices and counts the branching factors once the tree is built
+void BVH::numberNodes(BuildNode* bvh_node)
+{
+    bvh_node->df_idx = df_idx++;
+
+    if (!bvh_node->leaf())
+    {
+        branching[bvh_node->children.size()]++;
+        for (const auto &child : bvh_node->children)
+        {
+            numberNodes(child);
         }
     }
+}
+
+void BVH::compact(const BuildNode* bvh_node, uint32_t next_sibling)
+{
+    linear_tree[bvh_node->df_idx].BB = bvh_node->BB;
+    linear_tree[bvh_node->df_idx].next_sibling = next_sibling;
+    linear_tree[bvh_node->df_idx].start_surface = bvh_node->begin;
+    linear_tree[bvh_node->df_idx].num_surfaces = bvh_node->leaf() ? (uint8_t)bvh_node->size() : 0;
 
-    if (min_cost > S.size())
+    if (!bvh_node->children.empty())
     {
-        if (S.size() > max_leaf_surfaces)
+        for (size_t i = 0; i < bvh_node->children.size() - 1; i++)
         {
-            arbitrarySplit(bvh_node, 4);
-            for (const auto& child : bvh_node->children) recursiveBuildQuaternarySAH(child);
+            compact(bvh_node->children[i], bvh_node->children[i + 1]->df_idx);
         }
-        return;
+        compact(bvh_node->children.back(), 0);
+    }
+}
+
+/*****************************************************************************
+ Sum of the surface areas of all nodes relative to the root, where inner nodes
+ are weighted by the traversal cost and leaves by the number of primitives,
+ with the same unit costs as the SAH builders.
+******************************************************************************/
+double BVH::costSAH() const
+{
+    double root_area = linear_tree[0].BB.area();
+    if (root_area <= 0.0)
+    {
+        return 0.0;
     }
 
-    std::vector<std::shared_ptr<BuildNode>> new_nodes(4, nullptr);
+    double cost = 0.0;
+    for (const auto &node : linear_tree)
+    {
+        cost += node.BB.area() * (node.num_surfaces ? node.num_surfaces : 1.0);
+    }
+    return cost / root_area;
+}
 
-    for (const auto &s : S)
+/*****************************************************************************
+ Reorders the primitives of multi-primitive surfaces, i.e. meshes, to match
+ the order in which they are first referenced by the leaves. Primitives that 
+ are tested together are then also stored together in memory.
+******************************************************************************/
+void BVH::reorderPrimitives(const std::vector<std::shared_ptr<Surface::Base>> &surfaces)
+{
+    std::unordered_map<const Surface::Base*, std::vector<uint32_t>> new_indices, orders;
+    for (const auto &s : surfaces)
     {
-        glm::ivec2 idx = getIdx(s->BB().centroid());
+        if (s->numPrimitives() > 1)
+        {
+            new_indices[s.get()] = std::vector<uint32_t>(s->numPrimitives(), UINT32_MAX);
+        }
+    }
 
-        uint8_t child_idx = 0b00;
-        if (idx.x > split_bin.x) child_idx |= 0b01;
-        if (idx.y > split_bin.y) child_idx |= 0b10;
+    for (auto &p : ordered_primitives)
+    {
+        auto it = new_indices.find(p.surface);
+        if (it == new_indices.end())
+        {
+            continue;
+        }
 
-        if (!new_nodes[child_idx])
+        uint32_t &new_index = it->second[p.index];
+        if (new_index == UINT32_MAX)
         {
-            new_nodes[child_idx] = std::make_shared<BuildNode>();
+            auto &order = orders[p.surface];
+            new_index = (uint32_t)order.size();
+            order.push_back(p.index);
         }
+        p.index = new_index;
+    }
 
-        new_nodes[child_idx]->surfaces.push_back(s);
-        new_nodes[child_idx]->BB.merge(s->BB());
+    for (const auto &s : surfaces)
+    {
+        auto it = orders.find(s.get());
+        if (it != orders.end())
+        {
+            s->reorderPrimitives(it->second);
+        }
     }
+}
+
+void BVH::arbitrarySplit(BuildNode* bvh_node, size_t N, BuildThread &thread)
+{
+    N = std::min<size_t>(N, bvh_node->size());
 
-    S.clear();
+    // Primitive i goes to child i % N, regrouped so that each child gets a consecutive range
+    std::vector<Primitive> S(ordered_primitives.begin() + bvh_node->begin, ordered_primitives.begin() + bvh_node->end);
 
-    size_t num_children = 0;
-    for (const auto &child : new_nodes)
+    uint32_t idx = bvh_node->begin;
+    for (size_t c = 0; c < N; c++)
     {
-        if (child)
+        BuildNode* child = thread.newNode();
+        child->begin = idx;
+        for (size_t i = c; i < S.size(); i += N)
         {
-            num_children++;
-            bvh_node->children.push_back(child);
-            recursiveBuildQuaternarySAH(child);
+            ordered_primitives[idx++] = S[i];
+            child->BB.merge(primitiveBB(S[i]));
         }
+        child->end = idx;
+        bvh_node->children.push_back(child);
     }
-    branching[num_children]++;
 }
 
-void BVH::compact(std::shared_ptr<BuildNode> bvh_node, uint32_t next_sibling, uint32_t &surface_idx)
+/*****************************************************************************
+ Creates a wide node from the linear tree nodes in lanes, by repeatedly 
+ replacing the inner node with the largest surface area by its own children,
+ as long as they fit in the W lanes. If there are more than W nodes to begin
+ with (e.g. octree nodes in a 4-wide tree), neighboring nodes are grouped into
+ lanes that are collapsed into a wide node of their own. Inner lanes are then
+ collapsed recursively.
+******************************************************************************/
+template<size_t W>
+uint32_t BVH::collapse(std::vector<uint32_t> lanes, std::vector<WideNode<W>> &wide_tree) const
 {
-    linear_tree[bvh_node->df_idx].BB = bvh_node->BB;
-    linear_tree[bvh_node->df_idx].next_sibling = next_sibling;
-    linear_tree[bvh_node->df_idx].start_surface = surface_idx;
-    linear_tree[bvh_node->df_idx].num_surfaces = (uint8_t)bvh_node->surfaces.size();
+    while (lanes.size() < W)
+    {
+        double max_area = -1.0;
+        size_t expand = lanes.size();
+        std::vector<uint32_t> expand_children;
+        for (size_t i = 0; i < lanes.size(); i++)
+        {
+            const auto &node = linear_tree[lanes[i]];
+            if (node.num_surfaces || node.BB.area() <= max_area) continue;
 
-    for (const auto &surface : bvh_node->surfaces)
+            auto c = children(lanes[i]);
+            if (lanes.size() - 1 + c.size() <= W)
+            {
+                max_area = node.BB.area();
+                expand = i;
+                expand_children = std::move(c);
+            }
+        }
+        if (expand == lanes.size()) break;
+
+        lanes.erase(lanes.begin() + expand);
+        lanes.insert(lanes.end(), expand_children.begin(), expand_children.end());
+    }
+
+    std::vector<std::vector<uint32_t>> groups(std::min(lanes.size(), W));
+    for (size_t i = 0; i < lanes.size(); i++)
     {
-        ordered_surfaces[surface_idx] = surface;
-        surface_idx++;
+        groups[i * groups.size() / lanes.size()].push_back(lanes[i]);
     }
 
-    if (!bvh_node->children.empty())
+    auto roundDown = [](double v)
     {
-        for (size_t i = 0; i < bvh_node->children.size() - 1; i++)
+        float f = static_cast<float>(v);
+        return f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    };
+
+    auto roundUp = [](double v)
+    {
+        float f = static_cast<float>(v);
+        return f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    };
+
+    uint32_t wide_idx = static_cast<uint32_t>(wide_tree.size());
+    wide_tree.emplace_back();
+
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        BoundingBox BB;
+        for (const auto &node_idx : groups[i])
+        {
+            BB.merge(linear_tree[node_idx].BB);
+        }
+
+        for (int a = 0; a < 3; a++)
+        {
+            wide_tree[wide_idx].bounds[a][i] = roundDown(BB.min[a]);
+            wide_tree[wide_idx].bounds[a + 3][i] = roundUp(BB.max[a]);
+        }
+
+        const auto &node = linear_tree[groups[i].front()];
+        if (groups[i].size() == 1 && node.num_surfaces)
+        {
+            wide_tree[wide_idx].child[i] = node.start_surface;
+            wide_tree[wide_idx].num_surfaces[i] = node.num_surfaces;
+        }
+        else
         {
-            compact(bvh_node->children[i], bvh_node->children[i + 1]->df_idx, surface_idx);
+            uint32_t child_idx = collapse(groups[i].size() == 1 ? children(groups[i].front()) : groups[i], wide_tree);
+            wide_tree[wide_idx].child[i] = child_idx;
         }
-        compact(bvh_node->children.back(), 0, surface_idx);
     }
+    return wide_idx;
 }
 
-void BVH::arbitrarySplit(std::shared_ptr<BuildNode> bvh_node, size_t N)
+std::vector<uint32_t> BVH::children(uint32_t node_idx) const
 {
-    auto& S = bvh_node->surfaces;
+    std::vector<uint32_t> result;
+    for (uint32_t child_idx = node_idx + 1; child_idx != 0; child_idx = linear_tree[child_idx].next_sibling)
+    {
+        result.push_back(child_idx);
+    }
+    return result;
+}
 
-    N = std::min(N, S.size());
+size_t BVH::stackSize(uint32_t node_idx) const
+{
+    if (linear_tree[node_idx].num_surfaces) return 0;
 
-    for (int i = 0; i < N; i++)
+    size_t num_children = 0, max_child_size = 1;
+    for (uint32_t child_idx = node_idx + 1; child_idx != 0; child_idx = linear_tree[child_idx].next_sibling)
     {
-        bvh_node->children.push_back(std::make_shared<BuildNode>());
+        num_children++;
+        max_child_size = std::max(max_child_size, stackSize(child_idx));
     }
+    return num_children - 1 + max_child_size;
+}
+
+template<size_t W>
+size_t BVH::stackSize(const std::vector<WideNode<W>> &wide_tree, uint32_t node_idx) const
+{
+    const auto &node = wide_tree[node_idx];
 
-    for (size_t i = 0; i < S.size(); i++)
+    size_t num_lanes = 0, max_child_size = 1;
+    for (size_t i = 0; i < W; i++)
     {
-        size_t idx = i % N;
+        if (node.bounds[0][i] > node.bounds[3][i]) continue; // unused lane
 
-        bvh_node->children[idx]->surfaces.push_back(S[i]);
-        bvh_node->children[idx]->BB.merge(S[i]->BB());
+        num_lanes++;
+        if (!node.num_surfaces[i])
+        {
+            max_child_size = std::max(max_child_size, stackSize(wide_tree, node.child[i]));
+        }
     }
+    return num_lanes ? num_lanes - 1 + max_child_size : 0;
+}
 
-    S.clear();
+template<size_t W>
+BVH::WideNode<W>::WideNode()
+{
+    for (size_t i = 0; i < W; i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            bounds[a][i] = std::numeric_limits<float>::infinity();
+            bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+        }
+        child[i] = 0;
+        num_surfaces[i] = 0;
+    }
+}
 
-    branching[N]++;
+/*****************************************************************************
+ Slab test of all W children. Returns a bit mask of the intersected lanes and
+ writes the entry distances to t_entry, which must be 32-byte aligned. The 
+ operand order of min/max makes NaN slabs (0 * inf) non-restrictive.
+******************************************************************************/
+template<size_t W>
+uint32_t BVH::WideNode<W>::intersect(const WideRay& ray, float t_max, float* t_entry) const
+{
+    uint32_t hits = 0;
+#if defined(__AVX__)
+    if constexpr (W % 8 == 0)
+    {
+        for (size_t i = 0; i < W; i += 8)
+        {
+            __m256 t0 = _mm256_setzero_ps();
+            __m256 t1 = _mm256_set1_ps(t_max);
+            for (int a = 0; a < 3; a++)
+            {
+                __m256 o = _mm256_set1_ps(ray.origin[a]);
+                __m256 inv_d = _mm256_set1_ps(ray.inv_direction[a]);
+                __m256 near = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&bounds[ray.near[a]][i]), o), inv_d);
+                __m256 far = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&bounds[ray.far[a]][i]), o), inv_d);
+                t0 = _mm256_max_ps(near, t0);
+                t1 = _mm256_min_ps(far, t1);
+            }
+            t1 = _mm256_mul_ps(t1, _mm256_set1_ps(ROBUST_EXIT));
+            _mm256_store_ps(t_entry + i, t0);
+            hits |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ))) << i;
+        }
+        return hits;
+    }
+#endif
+#if defined(__SSE__) || defined(_M_X64)
+    for (size_t i = 0; i < W; i += 4)
+    {
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            __m128 o = _mm_set1_ps(ray.origin[a]);
+            __m128 inv_d = _mm_set1_ps(ray.inv_direction[a]);
+            __m128 near = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[ray.near[a]][i]), o), inv_d);
+            __m128 far = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[ray.far[a]][i]), o), inv_d);
+            t0 = _mm_max_ps(near, t0);
+            t1 = _mm_min_ps(far, t1);
+        }
+        t1 = _mm_mul_ps(t1, _mm_set1_ps(ROBUST_EXIT));
+        _mm_store_ps(t_entry + i, t0);
+        hits |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t0, t1))) << i;
+    }
+#else
+    for (size_t i = 0; i < W; i++)
+    {
+        float t0 = 0.0f, t1 = t_max;
+        for (int a = 0; a < 3; a++)
+        {
+            float near = (bounds[ray.near[a]][i] - ray.origin[a]) * ray.inv_direction[a];
+            float far = (bounds[ray.far[a]][i] - ray.origin[a]) * ray.inv_direction[a];
+            t0 = t0 < near ? near : t0;
+            t1 = t1 > far ? far : t1;
+        }
+        t_entry[i] = t0;
+        if (t0 <= t1 * ROBUST_EXIT) hits |= 1u << i;
+    }
+#endif
+    return hits;
 }
 
-BVH::SurfaceCentroid::SurfaceCentroid(std::shared_ptr<Surface::Base> surface)
-    : surface(surface), centroid(surface->BB().centroid()) { }
\ No newline at end of file
+BVH::PrimitiveCentroid::PrimitiveCentroid(const Primitive &primitive, const glm::dvec3 &centroid)
+    : primitive(primitive), centroid(centroid) { }
\ No newline at end of file
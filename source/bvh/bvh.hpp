@@ -1,17 +1,30 @@
 #pragma once
 
+#include <deque>
+
 #include <nlohmann/json.hpp>
 
 #include "../ray/intersection.hpp"
 #include "../octree/octree.hpp"
+#include "../common/priority-queue.hpp"
+#include "../common/fixed-stack.hpp"
 
 namespace Surface { class Base; }
+namespace Bundle { class Reader; class Writer; }
 
 class BVH
 {
-    struct SurfaceCentroid
+    // Primitive of a surface, e.g. a triangle of a mesh. Non-owning, the surfaces are owned by the scene.
+    struct Primitive
+    {
+        const Surface::Base* surface;
+        uint32_t index;
+        uint32_t id; // index in primitive_BBs, only used during construction
+    };
+
+    struct PrimitiveCentroid
     {
-        SurfaceCentroid(std::shared_ptr<Surface::Base> surface);
+        PrimitiveCentroid(const Primitive &primitive, const glm::dvec3 &centroid);
 
         glm::dvec3 pos() const
         {
@@ -19,22 +32,58 @@ class BVH
         }
 
         glm::dvec3 centroid;
-        std::shared_ptr<Surface::Base> surface;
+        Primitive primitive;
     };
 
     struct BuildNode
     {
         BuildNode() { }
 
-        bool leaf()
+        bool leaf() const
         {
             return children.empty();
         }
 
+        uint32_t size() const
+        {
+            return end - begin;
+        }
+
         BoundingBox BB;
-        std::vector<std::shared_ptr<BuildNode>> children;
-        std::vector<std::shared_ptr<Surface::Base>> surfaces;
-        uint32_t df_idx; // depth-first index in tree
+        std::vector<BuildNode*> children;
+        uint32_t begin = 0, end = 0; // range in ordered_primitives, covers all descendants
+        uint32_t df_idx;             // depth-first index in tree
+    };
+
+    enum class BuildMethod { BINARY_SAH, QUATERNARY_SAH, LBVH };
+
+    // Primitive reference, with a bounding box that is clipped by spatial splits
+    struct Reference
+    {
+        Primitive primitive;
+        BoundingBox BB;
+    };
+
+    struct BuildTask
+    {
+        BuildNode* node;
+        BuildMethod method;
+    };
+
+    /********************************************************************************
+     Per-thread build state. Each thread allocates nodes from its own arena, which 
+     owns them until the tree has been compacted. While the top of the tree is built,
+     subtrees small enough for a single thread are deferred to tasks instead.
+    ********************************************************************************/
+    struct BuildThread
+    {
+        BuildNode* newNode()
+        {
+            return &nodes.emplace_back();
+        }
+
+        std::deque<BuildNode> nodes;
+        std::vector<BuildTask>* tasks = nullptr;
     };
 
     /********************************************************************************
@@ -72,7 +121,7 @@ class BVH
         uint8_t num_surfaces;
         uint32_t next_sibling; // 0 if there is none
 
-        // Used for priority queue
+        // Used for priority queue and stack
         struct alignas(16) NodeIntersection
         {
             bool operator< (const NodeIntersection& i) const { return i.t < t; };
@@ -81,32 +130,163 @@ class BVH
         };
     };
 
+    /********************************************************************************
+     Wide node created by collapsing the N-ary tree. The bounding boxes of up to W
+     children are stored in struct-of-arrays layout so that all children can be
+     tested against a ray in a single SIMD slab test. Bounds are stored as floats,
+     rounded outwards so that the boxes are conservative. Unused lanes have empty
+     (inverted) bounds and can therefore never be hit.
+    ********************************************************************************/
+    struct WideRay;
+
+    template<size_t W>
+    struct alignas(64) WideNode
+    {
+        WideNode();
+
+        uint32_t intersect(const WideRay& ray, float t_max, float* t_entry) const;
+
+        float bounds[6][W];      // min x, y, z followed by max x, y, z
+        uint32_t child[W];       // wide node index, or start surface if leaf
+        uint8_t num_surfaces[W]; // 0 if child is inner node
+    };
+
 public:
     BVH(const BoundingBox &BB, 
         const std::vector<std::shared_ptr<Surface::Base>> &surfaces, 
-        const nlohmann::json &j);
+        const nlohmann::json &j,
+        uint32_t level = 0);
+
+    // Reads a BVH over surfaces written by write(), the surfaces must be the same as when it was written
+    BVH(Bundle::Reader &bundle,
+        const std::vector<std::shared_ptr<Surface::Base>> &surfaces,
+        uint32_t level = 0);
+
+    void write(Bundle::Writer &bundle, const std::vector<std::shared_ptr<Surface::Base>> &surfaces) const;
 
     Intersection intersect(const Ray& ray) const;
 
+    // True if any surface except ignore intersects the ray before t_max
+    bool occluded(const Ray& ray, double t_max, const Surface::Base* ignore = nullptr) const;
+
     static constexpr size_t leaf_surfaces = 8;
     static constexpr size_t max_leaf_surfaces = 0xFF;
+    static constexpr size_t max_branching = 8;
     std::map<size_t, size_t> branching;
 
     int bins_per_axis = 16;
 
+    /**************************************************************************
+     Nesting level of the BVH, 0 for the scene BVH and 1 for the bottom-level 
+     BVHs of instanced meshes, which are traversed from the leaves of the scene 
+     BVH. Each level has its own thread local traversal containers, since the 
+     traversal of a bottom-level BVH would otherwise clear the containers of 
+     the ongoing top-level traversal.
+    ***************************************************************************/
+    static constexpr uint32_t max_levels = 2;
+    const uint32_t level;
+
+    // Fixed-size stack traversal instead of priority queue traversal
+    bool stack_traversal = false;
+
 private:
-    void recursiveBuildFromOctree(const Octree<SurfaceCentroid> &octree_node, std::shared_ptr<BuildNode> bvh_node);
-    void recursiveBuildBinarySAH(std::shared_ptr<BuildNode> bvh_node);
-    void recursiveBuildQuaternarySAH(std::shared_ptr<BuildNode> bvh_node);
-    void compact(std::shared_ptr<BuildNode> bvh_node, uint32_t next_sibling, uint32_t &surface_idx);
+    void buildParallel(BuildNode* root, BuildMethod method, std::vector<BuildThread> &threads);
+    void build(BuildNode* bvh_node, BuildMethod method, BuildThread &thread);
+    void recursiveBuildFromOctree(const Octree<PrimitiveCentroid> &octree_node, BuildNode* bvh_node, BuildThread &thread);
+    void recursiveBuildBinarySAH(BuildNode* bvh_node, BuildThread &thread);
+    void recursiveBuildQuaternarySAH(BuildNode* bvh_node, BuildThread &thread);
+    void buildLBVH(BuildNode* root, const std::vector<Primitive> &primitives, int ploc_radius, std::vector<BuildThread> &threads);
+    void recursiveBuildLBVH(BuildNode* bvh_node, BuildThread &thread);
+    BuildNode* buildPLOC(std::vector<BuildNode*> clusters, int radius, BuildThread &thread);
+    void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, int bits) const;
+    void refit(BuildNode* bvh_node);
+    void recursiveBuildSBVH(BuildNode* bvh_node, std::vector<Reference> &references, BuildThread &thread);
+    void numberNodes(BuildNode* bvh_node);
+    void compact(const BuildNode* bvh_node, uint32_t next_sibling);
+
+    // Calls f(chunk, chunk_begin, chunk_end) for consecutive chunks of [begin, end), one per build thread
+    template<class F>
+    void parallelChunks(size_t begin, size_t end, F f) const;
+
+    // Reduces the primitives of the node in chunks, in parallel while building the top of the tree
+    template<class T, class Reduce, class Merge>
+    T parallelReduce(const BuildNode* bvh_node, const BuildThread &thread, Reduce reduce, Merge merge) const;
+
+    // Lays out the primitives of meshes in leaf order
+    void reorderPrimitives(const std::vector<std::shared_ptr<Surface::Base>> &surfaces);
+
+    const BoundingBox& primitiveBB(const Primitive &primitive) const
+    {
+        return primitive_BBs[primitive.id];
+    }
+
+    void arbitrarySplit(BuildNode* bvh_node, size_t N, BuildThread &thread);
+
+    template<size_t W>
+    uint32_t collapse(std::vector<uint32_t> lanes, std::vector<WideNode<W>> &wide_tree) const;
+
+    // Child indices of linear tree node
+    std::vector<uint32_t> children(uint32_t node_idx) const;
+
+    typedef PriorityQueue<LinearNode::NodeIntersection> TraversalQueue;
+    typedef FixedStack<LinearNode::NodeIntersection, 512> TraversalStack;
 
-    void arbitrarySplit(std::shared_ptr<BuildNode> bvh_node, size_t N);
+    template<class Queue>
+    Intersection traverse(const Ray& ray, Queue& to_visit) const;
+
+    template<size_t W, class Queue>
+    Intersection traverseWide(const std::vector<WideNode<W>> &wide_tree, const Ray& ray, Queue& to_visit) const;
+
+    template<class Queue>
+    static void pushOrdered(Queue& to_visit, LinearNode::NodeIntersection* hits, size_t num_hits);
+
+    template<class Queue>
+    static bool popNext(Queue& to_visit, double t_max, uint32_t& node);
+
+    // Expected cost of tracing a ray through the linear tree according to the SAH
+    double costSAH() const;
+
+    // Largest number of entries on the traversal stack during traversal of sub-tree
+    size_t stackSize(uint32_t node_idx) const;
+
+    template<size_t W>
+    size_t stackSize(const std::vector<WideNode<W>> &wide_tree, uint32_t node_idx) const;
+
+    void intersectLeaf(uint32_t start_surface, uint8_t num_surfaces, const Ray& ray, Intersection& intersect) const;
+
+    template<size_t W>
+    bool occludedWide(const std::vector<WideNode<W>> &wide_tree, const Ray& ray, double t_max, const Surface::Base* ignore) const;
+
+    bool occludedLeaf(uint32_t start_surface, uint8_t num_surfaces, const Ray& ray, double t_max, const Surface::Base* ignore) const;
 
     // Nodes stored in depth-first order
     std::vector<LinearNode> linear_tree;
 
-    std::vector<std::shared_ptr<Surface::Base>> ordered_surfaces;
+    // Collapsed trees, only one of these (or none) are used
+    std::vector<WideNode<4>> wide_tree4;
+    std::vector<WideNode<8>> wide_tree8;
+
+    std::vector<Primitive> ordered_primitives;
+
+    // Primitive bounding boxes, computed once before construction
+    std::vector<BoundingBox> primitive_BBs;
 
     // Depth first index used during construction
     uint32_t df_idx;
+
+    size_t num_build_threads;
+
+    // Sorted Morton codes of ordered_primitives during LBVH construction
+    std::vector<uint64_t> morton_codes;
+
+    // Subtrees with fewer primitives are built by a single thread
+    uint32_t task_size;
+
+    // SBVH construction state. Spatial splits are only considered if the overlap of the
+    // children of the best object split is larger than spatial_split_alpha times the root
+    // area, and if the number of references stays below max_references.
+    double spatial_split_alpha;
+    double root_area;
+    size_t num_references;
+    size_t max_references;
 };
\ No newline at end of file
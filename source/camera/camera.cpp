@@ -6,31 +6,31 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <fstream>
+#include <bit>
+
+#include <glm/gtx/component_wise.hpp>
 
 #include "../ray/ray.hpp"
-#include "../integrator/path-tracer/path-tracer.hpp"
-#include "../integrator/photon-mapper/photon-mapper.hpp"
+#include "../integrator/integrator.hpp"
 #include "../sampling/sampling.hpp"
 #include "../sampling/sampler.hpp"
 #include "../common/util.hpp"
 #include "../common/constexpr-math.hpp"
 #include "../common/format.hpp"
 #include "../common/constants.hpp"
+#include "../common/bundle.hpp"
+#include "partial-film.hpp"
+#include "tile-server.hpp"
 
-Camera::Camera(const nlohmann::json &j, const Option &option)
+Camera::Camera(const nlohmann::json &j, const Option &option, std::shared_ptr<Integrator> integrator)
+    : integrator(integrator ? integrator : Integrator::create(j, option.photon_map))
 {
-    if (option.photon_map)
-    {
-        integrator = std::make_shared<PhotonMapper>(j);
-    }
-    else
-    {
-        integrator = std::make_shared<PathTracer>(j);
-    }
 
     const nlohmann::json &c = j.at("cameras").at(option.camera_idx);
 
     image = Image(c.at("image"));
+    image_json = c.at("image").dump();
     if (c.find("film") != c.end())
         film = Film(image.width, image.height, c.at("film"));
     else
@@ -61,18 +61,97 @@ Camera::Camera(const nlohmann::json &j, const Option &option)
     }
 
     thin_lens = aperture_radius > 0.0 && focus_distance > 0.0;
+
+    if (c.find("adaptive") != c.end())
+    {
+        const nlohmann::json &a = c.at("adaptive");
+        adaptive = true;
+        adaptive_threshold = getOptional(a, "threshold", 0.01);
+        min_spp = pow2(getOptional(a, "min_sqrtspp", std::max<size_t>(sqrtspp / 4, 2)));
+        max_spp = pow2(getOptional(a, "max_sqrtspp", sqrtspp * 4));
+
+        // Pixels are sampled in doublings from min_spp, so powers of two keep each pixel at a 
+        // well stratified prefix of its Sobol sequence. min_spp can't exceed the sample budget.
+        min_spp = std::min(std::bit_ceil(min_spp), std::bit_floor(pow2(sqrtspp)));
+        max_spp = std::max(std::bit_floor(max_spp), min_spp);
+    }
+
+    if (c.find("progressive") != c.end())
+    {
+        const nlohmann::json &p = c.at("progressive");
+        progressive = true;
+        time_limit = getOptional(p, "time_limit", -1.0);
+        checkpoint_interval = getOptional(p, "checkpoint_interval", -1.0);
+        if (adaptive)
+        {
+            throw std::runtime_error("Adaptive sampling can't be combined with progressive rendering.");
+        }
+    }
+
+    last_spp = pow2(sqrtspp);
+    if (c.find("partial") != c.end())
+    {
+        const nlohmann::json &p = c.at("partial");
+        partial = true;
+        first_spp = p.at("first_spp");
+        last_spp = p.at("last_spp");
+        if (first_spp >= last_spp)
+        {
+            throw std::runtime_error("Empty sample range of partial render.");
+        }
+        if (adaptive || progressive)
+        {
+            throw std::runtime_error("Partial rendering can't be combined with adaptive sampling or progressive rendering.");
+        }
+    }
+
+    if (c.find("server") != c.end())
+    {
+        server_address = c.at("server").at("address");
+        scene_json = j.dump();
+        camera_idx = option.camera_idx;
+        photon_map = option.photon_map;
+    }
+
+    if (c.find("seed") != c.end())
+    {
+        seed = c.at("seed").get<uint32_t>();
+    }
+    else if (partial)
+    {
+        seed = 0;
+    }
+
+    // Identifies the scene and camera independently of how many samples are taken
+    nlohmann::json key_json = j;
+    auto &key_camera = key_json.at("cameras").at(option.camera_idx);
+    for (const auto &field : { "sqrtspp", "progressive", "checkpoint", "partial", "seed", "savename" })
+    {
+        key_camera.erase(field);
+    }
+    std::string key_string = key_json.dump() + (option.photon_map ? "photon_map" : "path_tracer");
+    scene_key = Bundle::hash(key_string.data(), key_string.size());
+
+    if (c.find("checkpoint") != c.end())
+    {
+        film_checkpoints = true;
+        film_checkpoint_interval = getOptional(c.at("checkpoint"), "interval", 300.0);
+
+        // The sample count and time limit can be changed before resuming, but not the partial range
+        uint64_t range[2] = { first_spp, last_spp };
+        checkpoint_key = partial ? Bundle::hash(range, sizeof(range), scene_key) : scene_key;
+    }
 }
 
-void Camera::samplePixel(size_t x, size_t y)
+void Camera::samplePixel(size_t x, size_t y, size_t begin, size_t end, Film::Tile& tile, PixelStats* stats)
 {
     double pixel_size = sensor_width / image.width;
-    size_t spp = pow2(sqrtspp);
 
     glm::dvec2 half_dim = glm::dvec2(image.width, image.height) * 0.5;
 
-    Sampler::initiate(static_cast<uint32_t>(y * image.width + x));
+    Sampler::initiate(static_cast<uint32_t>(y * image.width + x), seed);
 
-    for(int i = 0; i < spp; i++)
+    for (size_t i = begin; i < end; i++)
     {
         Sampler::setIndex(i);
 
@@ -93,14 +172,98 @@ void Camera::samplePixel(size_t x, size_t y)
             glm::dvec3 start = eye + left * aperture_sample.x + up * aperture_sample.y;
             ray = Ray(start, glm::normalize(focus_point - start), integrator->scene.ior);
         }
-        film.deposit(px, integrator->sampleRay(ray));
+        glm::dvec3 radiance = integrator->sampleRay(ray);
+        film.deposit(tile, px, radiance);
+
+        if (stats)
+        {
+            stats->add(glm::dot(radiance, glm::dvec3(0.2126, 0.7152, 0.0722)));
+        }
+    }
+}
+
+void Camera::PixelStats::add(double luminance)
+{
+    n++;
+    double delta = luminance - mean;
+    mean += delta / n;
+    M2 += delta * (luminance - mean);
+}
+
+double Camera::PixelStats::relativeError(double floor) const
+{
+    if (n < 2) return std::numeric_limits<double>::max();
+    return std::sqrt(M2 / ((n - 1) * n)) / std::max(mean, floor);
+}
+
+void Camera::sampleBucketAdaptive(const Bucket& bucket, Film::Tile& tile, std::vector<uint32_t>& tile_index)
+{
+    glm::ivec2 dims = bucket.max - bucket.min;
+
+    // Pixels that already have samples, from a resumed checkpoint, are complete
+    std::vector<size_t> pixels;
+    for (size_t i = 0; i < tile_index.size(); i++)
+    {
+        if (tile_index[i] == first_spp) pixels.push_back(i);
+    }
+    size_t num_pixels = pixels.size();
+    if (num_pixels == 0) return;
+
+    std::vector<PixelStats> stats(tile_index.size());
+    auto pixelSamples = [&](size_t i, size_t num_samples)
+    {
+        size_t n = stats[i].n;
+        samplePixel(bucket.min.x + i % dims.x, bucket.min.y + i / dims.x, n, n + num_samples, tile, &stats[i]);
+    };
+
+    double bucket_mean = 0.0;
+    for (size_t i : pixels)
+    {
+        pixelSamples(i, min_spp);
+        bucket_mean += stats[i].mean / num_pixels;
+    }
+
+    // Dark pixels are compared to a fraction of the bucket brightness, since 
+    // their relative error is large even though their absolute error isn't.
+    double floor = std::max(0.1 * bucket_mean, 1e-8);
+
+    size_t budget = last_spp * num_pixels - min_spp * num_pixels;
+
+    std::vector<std::pair<double, size_t>> noisy;
+    while (true)
+    {
+        noisy.clear();
+        for (size_t i : pixels)
+        {
+            double error = stats[i].relativeError(floor);
+            if (error > adaptive_threshold && stats[i].n < max_spp)
+            {
+                noisy.emplace_back(error, i);
+            }
+        }
+        std::sort(noisy.begin(), noisy.end(), std::greater<>());
+
+        bool sampled = false;
+        for (const auto& [error, i] : noisy)
+        {
+            size_t num_samples = std::min(stats[i].n, max_spp - stats[i].n);
+            if (num_samples > budget) continue;
+            pixelSamples(i, num_samples);
+            budget -= num_samples;
+            sampled = true;
+        }
+        if (!sampled) break;
+    }
+
+    for (size_t i : pixels)
+    {
+        tile_index[i] = static_cast<uint32_t>(stats[i].n);
     }
-    num_sampled_pixels++;
 }
 
 void Camera::sampleImage()
 {
-    std::vector<Bucket> buckets_vec;
+    std::vector<Bucket> buckets;
     for (size_t x = 0; x < image.width; x += bucket_size)
     {
         size_t x_end = x + bucket_size;
@@ -109,56 +272,281 @@ void Camera::sampleImage()
         {
             size_t y_end = y + bucket_size;
             if (y_end >= image.height) y_end = image.height;
-            buckets_vec.push_back(Bucket(glm::ivec2(x, y), glm::ivec2(x_end, y_end)));
+            buckets.push_back(Bucket(glm::ivec2(x, y), glm::ivec2(x_end, y_end)));
         }
     }
 
-    std::shuffle(buckets_vec.begin(), buckets_vec.end(), Random::engine);
-    WorkQueue<Bucket> buckets(buckets_vec);
-    buckets_vec.clear();
+    // Consecutive buckets along a Hilbert curve are spatially close, which 
+    // keeps the scene data used by each render thread coherent.
+    size_t grid_size = std::bit_ceil((std::max(image.width, image.height) + bucket_size - 1) / bucket_size);
+    std::vector<uint64_t> hilbert_index(buckets.size());
+    std::vector<size_t> order(buckets.size());
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        hilbert_index[i] = hilbertIndex(grid_size, buckets[i].min.x / bucket_size, buckets[i].min.y / bucket_size);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return hilbert_index[a] < hilbert_index[b]; });
+
+    std::vector<Bucket> ordered_buckets(buckets.size());
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        ordered_buckets[i] = buckets[order[i]];
+    }
+    buckets = std::move(ordered_buckets);
 
-    std::function<void(Camera*, WorkQueue<Bucket>&)> f = &Camera::sampleImageThread;
+    // Partial renders start at sample first_spp, so only samples after it are counted when merged
+    sample_index.assign(image.num_pixels, static_cast<uint32_t>(first_spp));
+    if (film_checkpoints)
+    {
+        loadCheckpoint();
+    }
 
-    std::vector<std::unique_ptr<std::thread>> threads(integrator->num_threads);
-    for (auto& thread : threads)
+    std::unique_ptr<TileServer> server;
+    if (!server_address.empty())
     {
-        thread = std::make_unique<std::thread>(f, this, std::ref(buckets));
+        server = std::make_unique<TileServer>(*this, server_address);
+        tile_server = server.get();
     }
 
-    std::function<void(Camera*, WorkQueue<Bucket>&)> p = &Camera::printInfoThread;
-    std::thread print_thread(p, this, std::ref(buckets));
+    rendering = true;
+    std::function<void(Camera*)> p = &Camera::printInfoThread;
+    std::thread print_thread(p, this);
 
+    if (progressive)
+    {
+        // Each pass ends at a power of two, which keeps the Sobol sequences of the pixels well stratified
+        for (size_t begin = 0, end = 1; begin < last_spp && !pastDeadline(); begin = end, end = std::min(2 * end, last_spp))
+        {
+            samplePass(buckets, begin, end);
+        }
+    }
+    else
+    {
+        samplePass(buckets, first_spp, last_spp);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(rendering_mutex);
+        rendering = false;
+    }
+    rendering_cv.notify_all();
     print_thread.join();
 
+    tile_server = nullptr;
+    server.reset();
+
+    film.develop(image);
+
+    if (film_checkpoints)
+    {
+        if (pastDeadline())
+        {
+            saveCheckpoint();
+        }
+        else
+        {
+            std::filesystem::remove(checkpointPath());
+        }
+    }
+}
+
+void Camera::samplePass(const std::vector<Bucket>& buckets, size_t begin, size_t end)
+{
+    if (tile_server)
+    {
+        tile_server->samplePass(buckets, begin, end);
+        return;
+    }
+
+    WorkStealingQueue<Bucket> work(buckets, integrator->num_threads);
+
+    std::function<void(Camera*, WorkStealingQueue<Bucket>&, size_t, size_t, size_t)> f = &Camera::sampleImageThread;
+
+    // Each pass starts new render threads, which start with zeroed counters
+
+    std::vector<std::unique_ptr<std::thread>> threads(integrator->num_threads);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i] = std::make_unique<std::thread>(f, this, std::ref(work), i, begin, end);
+    }
+
     for (auto& thread : threads)
     {
         thread->join();
     }
+}
 
-    for (int y = 0; y < image.height; y++)
+void Camera::sampleImageThread(WorkStealingQueue<Bucket>& buckets, size_t thread, size_t begin, size_t end)
+{
+    Bucket bucket;
+    while (buckets.getWork(thread, bucket))
     {
-        for (int x = 0; x < image.width; x++)
+        if (pastDeadline()) break;
+
+        // Splits buckets into quadrants near the end of the pass, which other threads 
+        // can then steal instead of waiting for one thread to finish a large bucket.
+        while (integrator->num_threads > 1 && buckets.size() < integrator->num_threads && glm::compMin(bucket.max - bucket.min) >= 2 * min_bucket_size)
         {
-            image(x, y) = film.scan(x, y);
+            glm::ivec2 mid = (bucket.min + bucket.max) / 2;
+            buckets.push(thread, Bucket(glm::ivec2(mid.x, bucket.min.y), glm::ivec2(bucket.max.x, mid.y)));
+            buckets.push(thread, Bucket(glm::ivec2(bucket.min.x, mid.y), glm::ivec2(mid.x, bucket.max.y)));
+            buckets.push(thread, Bucket(mid, bucket.max));
+            bucket.max = mid;
         }
+
+        std::vector<uint32_t> tile_index = bucketSampleIndex(bucket);
+        Film::Tile tile = film.tile(bucket.min, bucket.max);
+        sampleBucket(bucket, begin, end, tile, tile_index);
+        mergeBucket(bucket, tile, tile_index);
     }
+
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+    perf_counters += PerfCounters::local();
 }
 
-void Camera::sampleImageThread(WorkQueue<Bucket>& buckets)
+// Only the render thread of the bucket modifies the sample indices of its pixels
+std::vector<uint32_t> Camera::bucketSampleIndex(const Bucket& bucket) const
 {
-    Bucket bucket;
-    while (buckets.getWork(bucket))
+    glm::ivec2 dims = bucket.max - bucket.min;
+    std::vector<uint32_t> tile_index(dims.x * dims.y);
+    for (size_t i = 0; i < tile_index.size(); i++)
+    {
+        tile_index[i] = sample_index[(bucket.min.y + i / dims.x) * image.width + bucket.min.x + i % dims.x];
+    }
+    return tile_index;
+}
+
+void Camera::sampleBucket(const Bucket& bucket, size_t begin, size_t end, Film::Tile& tile, std::vector<uint32_t>& tile_index)
+{
+    if (adaptive)
+    {
+        sampleBucketAdaptive(bucket, tile, tile_index);
+        return;
+    }
+
+    // The deadline is checked per pixel since a row of a wide bucket can take long at high spp
+    for (size_t y = bucket.min.y, i = 0; y < bucket.max.y; y++)
     {
-        for (size_t y = bucket.min.y; y < bucket.max.y; y++)
+        for (size_t x = bucket.min.x; x < bucket.max.x; x++, i++)
         {
-            for (size_t x = bucket.min.x; x < bucket.max.x; x++)
+            if (tile_index[i] < end)
             {
-                samplePixel(x, y);
+                if (pastDeadline()) return;
+
+                samplePixel(x, y, std::max<size_t>(begin, tile_index[i]), end, tile);
+                tile_index[i] = static_cast<uint32_t>(end);
             }
         }
     }
 }
 
+void Camera::mergeBucket(const Bucket& bucket, const Film::Tile& tile, const std::vector<uint32_t>& tile_index)
+{
+    glm::ivec2 dims = bucket.max - bucket.min;
+
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+    film.merge(tile);
+    for (size_t i = 0; i < tile_index.size(); i++)
+    {
+        uint32_t &index = sample_index[(bucket.min.y + i / dims.x) * image.width + bucket.min.x + i % dims.x];
+        num_samples += tile_index[i] - index;
+        index = tile_index[i];
+    }
+}
+
+/*************************************************************************
+ Index of cell (x, y) along the Hilbert curve through an n x n grid, 
+ where n is a power of two.
+**************************************************************************/
+uint64_t Camera::hilbertIndex(size_t n, size_t x, size_t y)
+{
+    uint64_t d = 0;
+    for (size_t s = n / 2; s > 0; s /= 2)
+    {
+        size_t rx = (x & s) > 0;
+        size_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+bool Camera::pastDeadline() const
+{
+    return progressive && time_limit > 0.0 && std::chrono::steady_clock::now() >= deadline;
+}
+
+std::filesystem::path Camera::checkpointPath() const
+{
+    return savename + ".checkpoint";
+}
+
+void Camera::saveCheckpoint()
+{
+    try
+    {
+        Bundle::Writer writer(checkpointPath(), checkpoint_key);
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        writer.write(seed);
+        writer.write(sample_index);
+        film.write(writer);
+        writer.finish();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cout << "\nUnable to write film checkpoint: " << ex.what() << std::endl;
+    }
+}
+
+void Camera::loadCheckpoint()
+{
+    if (!std::filesystem::exists(checkpointPath())) return;
+
+    try
+    {
+        Bundle::Reader reader(checkpointPath(), checkpoint_key);
+        uint32_t checkpoint_seed = reader.read<uint32_t>();
+        std::vector<uint32_t> index;
+        reader.read(index);
+        if (index.size() != image.num_pixels)
+        {
+            throw std::runtime_error("Image size mismatch.");
+        }
+        film.read(reader);
+
+        seed = checkpoint_seed;
+        sample_index = std::move(index);
+        num_samples = 0;
+        for (uint32_t &i : sample_index)
+        {
+            i = std::max(i, static_cast<uint32_t>(first_spp));
+            num_samples += i - first_spp;
+        }
+        last_num_samples = num_samples;
+
+        std::cout << "Resuming from film checkpoint with " 
+                  << static_cast<double>(num_samples) / image.num_pixels << " samples per pixel" << std::endl << std::endl;
+    }
+    catch (const std::exception& ex)
+    {
+        std::cout << ex.what() << " Ignoring film checkpoint " << checkpointPath().string() << std::endl << std::endl;
+    }
+}
+
+void Camera::saveImage() const
+{
+    integrator->saveImage(image, savename);
+}
+
 void Camera::lookAt(const glm::dvec3& p)
 {
     forward = glm::normalize(p - eye);
@@ -170,17 +558,53 @@ void Camera::lookAt(const glm::dvec3& p)
 void Camera::capture()
 {
     std::cout << std::endl << std::string(28, '-') << "| MAIN RENDERING PASS |" << std::string(28, '-') << std::endl;
-    std::cout << std::endl << "Samples per pixel: " << pow2(static_cast<double>(sqrtspp)) << std::endl << std::endl;
+    if (partial)
+    {
+        std::cout << std::endl << "Samples: [" << first_spp << ", " << last_spp << ")" << std::endl << std::endl;
+    }
+    else
+    {
+        std::cout << std::endl << "Samples per pixel: " << last_spp << std::endl << std::endl;
+    }
     auto before = std::chrono::system_clock::now();
+    perf_counters = PerfCounters();
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int64_t>(time_limit * 1000.0));
     sampleImage();
     saveImage();
+    if (partial)
+    {
+        PartialFilm::write(savename + ".film", { scene_key, seed, first_spp, last_spp, image_json }, film);
+    }
     auto now = std::chrono::system_clock::now();
     std::cout << "\r" + std::string(100, ' ') + "\r";
     std::cout << "Render Completed: " << Format::date(now);
     std::cout << ", Elapsed Time: " << Format::timeDuration(std::chrono::duration_cast<std::chrono::milliseconds>(now - before).count()) << std::endl;
+    if (adaptive || progressive)
+    {
+        std::cout << "Average samples per pixel: " << static_cast<double>(num_samples) / image.num_pixels << std::endl;
+    }
+    if (PerfCounters::enabled && server_address.empty())
+    {
+        saveStats(std::chrono::duration<double>(now - before).count());
+    }
+}
+
+void Camera::saveStats(double seconds) const
+{
+    nlohmann::json stats = perf_counters.toJSON(seconds, num_samples);
+    stats["threads"] = integrator->num_threads;
+    stats["width"] = image.width;
+    stats["height"] = image.height;
+
+    std::string path = savename + ".stats.json";
+    std::ofstream file(path);
+    if (file << stats.dump(2) << std::endl)
+    {
+        std::cout << "Render statistics written to " << path << std::endl;
+    }
 }
 
-void Camera::printInfoThread(WorkQueue<Bucket>& buckets)
+void Camera::printInfoThread()
 {
     auto printProgressInfo = [](double progress, size_t msec_duration, size_t sps, std::ostream& out)
     {
@@ -195,32 +619,58 @@ void Camera::printInfoThread(WorkQueue<Bucket>& buckets)
         out << ss.str();
     };
 
-    while (!buckets.empty())
+    size_t total_samples = (last_spp - first_spp) * image.num_pixels;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    auto last_film_checkpoint = last_checkpoint;
+
+    std::unique_lock<std::mutex> lock(rendering_mutex);
+    while (rendering)
     {
-        if (num_sampled_pixels != last_num_sampled_pixels)
+        if (num_samples != last_num_samples)
         {
-            size_t delta_pixels = num_sampled_pixels - last_num_sampled_pixels;
-            size_t pixels_left = image.num_pixels - num_sampled_pixels;
+            size_t delta_samples = num_samples - last_num_samples;
+            size_t samples_left = total_samples - std::min<size_t>(num_samples, total_samples);
 
             auto now = std::chrono::steady_clock::now();
             auto delta_t = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_update);
 
-            times.push_back(static_cast<double>(delta_pixels) / delta_t.count());
+            times.push_back(static_cast<double>(delta_samples) / delta_t.count());
             if (times.size() > num_times)
                 times.pop_front();
 
             // moving average
-            double pixels_per_msec = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+            double samples_per_msec = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
 
-            double progress = 100.0 * static_cast<double>(num_sampled_pixels) / image.num_pixels;
-            size_t msec_left = static_cast<size_t>(pixels_left / pixels_per_msec);
-            size_t sps = static_cast<size_t>(pixels_per_msec * 1000.0 * pow2(static_cast<double>(sqrtspp)));
+            double progress = 100.0 * static_cast<double>(total_samples - samples_left) / total_samples;
+            size_t msec_left = static_cast<size_t>(samples_left / samples_per_msec);
+            if (progressive && time_limit > 0.0)
+            {
+                auto msec_to_deadline = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+                msec_left = std::min<size_t>(msec_left, std::max<int64_t>(msec_to_deadline, 0));
+            }
+            size_t sps = static_cast<size_t>(samples_per_msec * 1000.0);
 
             printProgressInfo(progress, msec_left, sps, std::cout);
 
             last_update = now;
-            last_num_sampled_pixels = num_sampled_pixels;
+            last_num_samples = num_samples;
+        }
+
+        if (film_checkpoints && std::chrono::steady_clock::now() - last_film_checkpoint >= 
+            std::chrono::milliseconds(static_cast<int64_t>(film_checkpoint_interval * 1000.0)))
+        {
+            saveCheckpoint();
+            last_film_checkpoint = std::chrono::steady_clock::now();
+        }
+
+        if (progressive && checkpoint_interval > 0.0 &&
+            std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::milliseconds(static_cast<int64_t>(checkpoint_interval * 1000.0)))
+        {
+            film.develop(image);
+            saveImage();
+            last_checkpoint = std::chrono::steady_clock::now();
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+        rendering_cv.wait_for(lock, std::chrono::milliseconds(1000), [this] { return !rendering; });
     }
 }
\ No newline at end of file
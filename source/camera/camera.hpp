@@ -3,6 +3,9 @@
 #include <chrono>
 #include <deque>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
 
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
@@ -13,23 +16,24 @@
 #include "film.hpp"
 
 #include "../scene/scene.hpp"
-#include "../common/work-queue.hpp"
+#include "../common/work-stealing-queue.hpp"
 #include "../common/option.hpp"
+#include "../common/perf-counters.hpp"
+#include "../sampling/sampler.hpp"
 
 class Integrator;
+class TileServer;
 
 class Camera
 {
 public:
-    Camera(const nlohmann::json &j, const Option &option);
+    // Creates a new integrator for the scene unless one is given
+    Camera(const nlohmann::json &j, const Option &option, std::shared_ptr<Integrator> integrator = nullptr);
 
     void capture();
     void sampleImage();
 
-    void saveImage() const
-    {
-        image.save(savename);
-    }
+    void saveImage() const;
 
     void setPosition(const glm::dvec3& p)
     {
@@ -38,6 +42,12 @@ public:
 
     void lookAt(const glm::dvec3& p);
 
+    // Number of samples taken during the last render
+    size_t numSamples() const
+    {
+        return num_samples;
+    }
+
     size_t sqrtspp;
 
     glm::dvec3 eye;
@@ -50,7 +60,58 @@ public:
 
     std::string savename;
 
+    /**************************************************************************
+     Adaptive sampling. Each pixel first gets min_spp samples, and the rest 
+     of the sample budget of the bucket is then spent on the pixels with the 
+     largest relative error, by doubling their number of samples until all 
+     pixels are below adaptive_threshold, reach max_spp or the budget is out.
+    ***************************************************************************/
+    bool adaptive = false;
+    double adaptive_threshold;
+    size_t min_spp, max_spp;
+
+    /**************************************************************************
+     Progressive rendering. The image is rendered in passes that each double 
+     the number of samples per pixel, which continue until sqrtspp^2 samples 
+     per pixel have been taken or until time_limit seconds have passed. The 
+     image is saved every checkpoint_interval seconds during rendering.
+    ***************************************************************************/
+    bool progressive = false;
+    double time_limit = -1.0, checkpoint_interval = -1.0; // seconds, non-positive if unused
+
+    /**************************************************************************
+     Film checkpoints. The film and the number of samples taken in each pixel 
+     are written to savename.checkpoint every film_checkpoint_interval 
+     seconds and when a time limited render stops early. A later render of 
+     the same scene and camera resumes from the checkpoint with the same 
+     Sampler seed, and continues the sample sequence of each pixel from the 
+     sample index where it stopped. The checkpoint is removed once the 
+     render completes.
+    ***************************************************************************/
+    bool film_checkpoints = false;
+    double film_checkpoint_interval;
+    uint64_t checkpoint_key;
+
+    /**************************************************************************
+     Partial rendering. Only samples [first_spp, last_spp) of each pixel are 
+     taken, and the raw film is saved to savename.film so that the partial 
+     films of renders on different machines can be merged into one image. 
+     Partial renders use a fixed Sampler seed unless a seed is specified.
+    ***************************************************************************/
+    bool partial = false;
+    size_t first_spp = 0, last_spp;
+    uint64_t scene_key;
+    std::string image_json;
+
+    // Seed of the sample sequences of this camera, the random seed of the process unless specified
+    uint32_t seed = Sampler::globalSeed();
+
+    // Address of the tile server that distributes the buckets to worker processes, empty if rendering locally
+    std::string server_address;
+
 private:
+    friend class TileServer;
+
     struct Bucket
     {
         Bucket() : min(0), max(0) { }
@@ -60,18 +121,70 @@ private:
         glm::ivec2 max;
     };
 
-    void samplePixel(size_t x, size_t y);
-    void sampleImageThread(WorkQueue<Bucket>& buckets);
+    // Running mean and variance of the sample luminance of a pixel
+    struct PixelStats
+    {
+        void add(double luminance);
+
+        // Standard error of the mean relative to the mean, which is clamped to floor from below
+        double relativeError(double floor) const;
+
+        size_t n = 0;
+        double mean = 0.0, M2 = 0.0;
+    };
+
+    // Takes samples [begin, end) of the pixel, and adds their luminance to stats if it isn't null
+    void samplePixel(size_t x, size_t y, size_t begin, size_t end, Film::Tile& tile, PixelStats* stats = nullptr);
+    void sampleImageThread(WorkStealingQueue<Bucket>& buckets, size_t thread, size_t begin, size_t end);
+    // Samples [begin, end) of the pixels in bucket that don't already have them according to tile_index, 
+    // which is then updated to the resulting number of samples of each bucket pixel.
+    void sampleBucket(const Bucket& bucket, size_t begin, size_t end, Film::Tile& tile, std::vector<uint32_t>& tile_index);
+
+    std::vector<uint32_t> bucketSampleIndex(const Bucket& bucket) const;
+
+    // Thread safe
+    void mergeBucket(const Bucket& bucket, const Film::Tile& tile, const std::vector<uint32_t>& tile_index);
+
+    // Writes the resulting number of samples of each bucket pixel to tile_index
+    void sampleBucketAdaptive(const Bucket& bucket, Film::Tile& tile, std::vector<uint32_t>& tile_index);
+
+    // Samples [begin, end) of each pixel in buckets using all render threads
+    void samplePass(const std::vector<Bucket>& buckets, size_t begin, size_t end);
+
+    bool pastDeadline() const;
+
+    static uint64_t hilbertIndex(size_t n, size_t x, size_t y);
+
+    std::filesystem::path checkpointPath() const;
+    void saveCheckpoint();
+    void loadCheckpoint();
+
+    void printInfoThread();
 
-    void printInfoThread(WorkQueue<Bucket>& buckets);
+    void saveStats(double seconds) const;
 
     const size_t bucket_size = 32;
+    const int min_bucket_size = 8;
 
     std::shared_ptr<Integrator> integrator;
 
-    std::atomic_size_t num_sampled_pixels = 0;
-    size_t last_num_sampled_pixels = 0;
+    // Sent to the workers of the tile server
+    std::string scene_json;
+    int camera_idx;
+    bool photon_map;
+    TileServer* tile_server = nullptr;
+
+    std::vector<uint32_t> sample_index; // index of the next sample of each pixel
+    std::mutex checkpoint_mutex; // held when merging tiles and updating sample_index
+
+    std::atomic_size_t num_samples = 0;
+    PerfCounters perf_counters; // of the local render threads, added when each thread finishes
+    bool rendering = false;
+    std::mutex rendering_mutex;
+    std::condition_variable rendering_cv; // wakes the print thread when rendering is done
+    size_t last_num_samples = 0;
     std::chrono::time_point<std::chrono::steady_clock> last_update = std::chrono::steady_clock::now();
+    std::chrono::time_point<std::chrono::steady_clock> deadline;
     const size_t num_times = 32;
     std::deque<double> times;
 };
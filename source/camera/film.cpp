@@ -7,17 +7,18 @@
 
 #include "filter.hpp"
 #include "../common/util.hpp"
+#include "../common/bundle.hpp"
 
 Film::Film() { }
 
 Film::Film(size_t width, size_t height)
-    : width(width), height(height), blob(width* height), 
+    : width(width), height(height), blob(width* height), merge_mutex(std::make_unique<std::mutex>()),
       filter_function(Filter::box), radius(0.5), 
       two_inv_radius(2.0 / radius), inv_dx(0.0)
 { }
 
 Film::Film(size_t width, size_t height, const nlohmann::json& j)
-    : width(width), height(height), blob(width* height)
+    : width(width), height(height), blob(width* height), merge_mutex(std::make_unique<std::mutex>())
 {
     std::string filter_type = j.at("filter");
     std::transform(filter_type.begin(), filter_type.end(), filter_type.begin(), tolower);
@@ -58,29 +59,105 @@ Film::Film(size_t width, size_t height, const nlohmann::json& j)
     }
 }
 
-void Film::deposit(const glm::dvec2& p, const glm::dvec3& v)
+Film::Tile Film::tile(const glm::ivec2& min, const glm::ivec2& max) const
 {
-    ivec2 min = glm::max(ivec2(p + 0.5 - radius), ivec2(0));
-    ivec2 max = glm::min(ivec2(p - 0.5 + radius), ivec2(width - 1, height - 1));
+    int64_t margin = static_cast<int64_t>(std::ceil(radius));
+
+    Tile tile;
+    tile.min = glm::max(ivec2(min) - margin, ivec2(0));
+    tile.max = glm::min(ivec2(max) + (margin - 1), ivec2(width - 1, height - 1));
+
+    ivec2 dims = tile.max - tile.min + int64_t(1);
+    tile.pixels.resize(dims.x * dims.y, glm::dvec4(0.0));
+    return tile;
+}
+
+void Film::deposit(Tile& tile, const glm::dvec2& p, const glm::dvec3& v) const
+{
+    ivec2 min = glm::max(ivec2(p + 0.5 - radius), tile.min);
+    ivec2 max = glm::min(ivec2(p - 0.5 + radius), tile.max);
 
     // Lazy but general and about as fast as can be
     thread_local std::vector<double> weights_x; weights_x.clear();
     for (int64_t x = min.x; x <= max.x; x++)
         weights_x.push_back(filter(x + 0.5 - p.x));
 
+    int64_t tile_width = tile.max.x - tile.min.x + 1;
     for (int64_t y = min.y; y <= max.y; y++)
     {
         double weight_y = filter(y + 0.5 - p.y);
+        glm::dvec4* row = tile.pixels.data() + (y - tile.min.y) * tile_width;
         for (int64_t x = min.x; x <= max.x; x++)
         {
-            blob[y * width + x].update(v, weight_y * weights_x[x - min.x]);
+            double weight = weight_y * weights_x[x - min.x];
+            row[x - tile.min.x] += glm::dvec4(v * weight, weight);
+        }
+    }
+}
+
+void Film::merge(const Tile& tile)
+{
+    std::lock_guard<std::mutex> lock(*merge_mutex);
+
+    size_t i = 0;
+    for (int64_t y = tile.min.y; y <= tile.max.y; y++)
+    {
+        for (int64_t x = tile.min.x; x <= tile.max.x; x++)
+        {
+            blob[y * width + x] += tile.pixels[i++];
         }
     }
 }
 
+void Film::merge(const Film& film)
+{
+    if (film.blob.size() != blob.size())
+    {
+        throw std::runtime_error("Film size mismatch.");
+    }
+
+    std::lock_guard<std::mutex> lock(*merge_mutex);
+
+    for (size_t i = 0; i < blob.size(); i++)
+    {
+        blob[i] += film.blob[i];
+    }
+}
+
 glm::dvec3 Film::scan(size_t col, size_t row) const
 {
-    return blob[row * width + col].get();
+    const glm::dvec4 &sum = blob[row * width + col];
+    if (sum.w == 0.0) return glm::dvec3(0.0);
+    return glm::max(glm::dvec3(sum) / sum.w, 0.0);
+}
+
+void Film::develop(Image& image) const
+{
+    std::lock_guard<std::mutex> lock(*merge_mutex);
+
+    for (size_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            image(x, y) = scan(x, y);
+        }
+    }
+}
+
+void Film::write(Bundle::Writer& bundle) const
+{
+    bundle.write(blob);
+}
+
+void Film::read(Bundle::Reader& bundle)
+{
+    std::vector<glm::dvec4> pixels;
+    bundle.read(pixels);
+    if (pixels.size() != blob.size())
+    {
+        throw std::runtime_error("Film size mismatch.");
+    }
+    blob = std::move(pixels);
 }
 
 double Film::filter(double x) const
@@ -95,19 +172,3 @@ double Film::filter(double x) const
         return filter_cache[static_cast<size_t>(inv_dx * std::abs(x) + 0.5)];
     }
 }
-
-void Film::Splat::update(const glm::dvec3& v, double weight)
-{
-    rgb_sum[0] += v[0] * weight;
-    rgb_sum[1] += v[1] * weight;
-    rgb_sum[2] += v[2] * weight;
-    weight_sum += weight;
-}
-
-glm::dvec3 Film::Splat::get() const
-{
-    glm::dvec3 res(rgb_sum[0].load(), rgb_sum[1].load(), rgb_sum[2].load());
-    double w = weight_sum.load();
-    if (w == 0.0) return glm::dvec3(0.0);
-    return glm::max(res / w, 0.0);
-}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <atomic>
+#include <mutex>
+#include <memory>
 #include <vector>
 #include <functional>
 
@@ -8,6 +9,10 @@
 
 #include <nlohmann/json.hpp>
 
+#include "image.hpp"
+
+namespace Bundle { class Reader; class Writer; }
+
 class Film
 {
     typedef glm::vec<2, int64_t> ivec2;
@@ -19,25 +24,52 @@ public:
 
     Film(size_t width, size_t height, const nlohmann::json& j);
 
-    void deposit(const glm::dvec2& p, const glm::dvec3& v);
+    /**************************************************************************
+     Private film region of a render thread, covering a bucket of pixels and 
+     the margin that the filter of samples in the bucket can reach. Samples 
+     are accumulated in the tile without any synchronization, and the tile is 
+     then merged into the film once the bucket has been sampled.
+    ***************************************************************************/
+    class Tile
+    {
+    public:
+        Tile() { }
+
+        // Raw accumulators, used to send tiles between processes
+        std::vector<glm::dvec4>& data() { return pixels; }
+        const std::vector<glm::dvec4>& data() const { return pixels; }
+
+    private:
+        friend class Film;
+
+        ivec2 min, max; // inclusive pixel bounds in film
+        std::vector<glm::dvec4> pixels; // weighted rgb sum and weight sum
+    };
+
+    // Tile for the pixels in [min, max)
+    Tile tile(const glm::ivec2& min, const glm::ivec2& max) const;
+
+    void deposit(Tile& tile, const glm::dvec2& p, const glm::dvec3& v) const;
+
+    // Thread safe
+    void merge(const Tile& tile);
+    void merge(const Film& film);
 
     glm::dvec3 scan(size_t col, size_t row) const;
 
-private:
-    double filter(double x) const;
+    // Scans the whole film into image, thread safe with respect to merge
+    void develop(Image& image) const;
 
-    struct Splat
-    {
-        void update(const glm::dvec3& v, double weight);
+    // Not thread safe with respect to merge
+    void write(Bundle::Writer& bundle) const;
+    void read(Bundle::Reader& bundle);
 
-        glm::dvec3 get() const;
+private:
+    double filter(double x) const;
 
-    private:
-        std::atomic<double> rgb_sum[3];
-        std::atomic<double> weight_sum;
-    };
+    std::vector<glm::dvec4> blob; // weighted rgb sum and weight sum
 
-    std::vector<Splat> blob;
+    std::unique_ptr<std::mutex> merge_mutex;
 
     std::vector<double> filter_cache;
 
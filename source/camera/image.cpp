@@ -50,6 +50,48 @@ void Image::save(const std::string& filename) const
     out_tonemapped.close();
 }
 
+void Image::saveFalseColor(const std::string& filename, size_t channel) const
+{
+    double max_value = 0.0;
+    for (const auto& p : blob)
+    {
+        max_value = std::max(max_value, p[channel]);
+    }
+
+    HeaderTGA header((uint16_t)width, (uint16_t)height);
+    std::ofstream out(filename + ".tga", std::ios::binary);
+    out.write(reinterpret_cast<char*>(&header), sizeof(header));
+    for (const auto& p : blob)
+    {
+        auto fp = truncate(turbo(max_value > 0.0 ? p[channel] / max_value : 0.0));
+        out.write(reinterpret_cast<char*>(fp.data()), fp.size() * sizeof(uint8_t));
+    }
+    out.close();
+}
+
+void Image::savePFM(const std::string& filename) const
+{
+    std::ofstream out(filename + ".pfm", std::ios::binary);
+
+    // Negative scale for little-endian data, which is assumed here
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+
+    // Rows are stored bottom to top
+    std::vector<float> row(width * 3);
+    for (size_t y = height; y-- > 0;)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            const auto& p = blob[y * width + x];
+            row[x * 3 + 0] = static_cast<float>(p.r);
+            row[x * 3 + 1] = static_cast<float>(p.g);
+            row[x * 3 + 2] = static_cast<float>(p.b);
+        }
+        out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    out.close();
+}
+
 glm::dvec3& Image::operator()(size_t col, size_t row)
 {
     return blob[row * width + col];
@@ -15,6 +15,12 @@ struct Image
 
     void save(const std::string& filename) const;
 
+    // Saves one channel mapped from [0, max value] to false colors as filename.tga
+    void saveFalseColor(const std::string& filename, size_t channel) const;
+
+    // Saves the raw pixel values as a Portable FloatMap, filename.pfm
+    void savePFM(const std::string& filename) const;
+
     glm::dvec3& operator()(size_t col, size_t row);
 
     size_t width, height;
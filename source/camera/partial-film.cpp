@@ -0,0 +1,95 @@
+#include "partial-film.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#include <nlohmann/json.hpp>
+
+#include "image.hpp"
+#include "../common/bundle.hpp"
+
+namespace PartialFilm
+{
+    // Partial films of different scenes are told apart by the scene key in the header instead
+    constexpr uint64_t key = 0x7061727469616cull;
+
+    void write(const std::filesystem::path &path, const Header &header, const Film &film)
+    {
+        Bundle::Writer writer(path, key);
+        writer.write(header.scene_key);
+        writer.write(header.seed);
+        writer.write(header.first_spp);
+        writer.write(header.last_spp);
+        writer.write(std::vector<char>(header.image_json.begin(), header.image_json.end()));
+        film.write(writer);
+        writer.finish();
+    }
+
+    void merge(const std::vector<std::filesystem::path> &paths, const std::string &savename)
+    {
+        if (paths.empty())
+        {
+            throw std::runtime_error("No partial films to merge.");
+        }
+
+        Header first;
+        Image image;
+        Film film;
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+
+        for (const auto &path : paths)
+        {
+            Bundle::Reader reader(path, key);
+
+            Header header;
+            header.scene_key = reader.read<uint64_t>();
+            header.seed = reader.read<uint32_t>();
+            header.first_spp = reader.read<uint64_t>();
+            header.last_spp = reader.read<uint64_t>();
+            std::vector<char> image_json;
+            reader.read(image_json);
+            header.image_json.assign(image_json.begin(), image_json.end());
+
+            if (ranges.empty())
+            {
+                first = header;
+                image = Image(nlohmann::json::parse(header.image_json));
+                film = Film(image.width, image.height);
+            }
+            else if (header.scene_key != first.scene_key || header.image_json != first.image_json)
+            {
+                throw std::runtime_error(path.string() + " is a partial film of a different scene or camera.");
+            }
+            else if (header.seed != first.seed)
+            {
+                throw std::runtime_error(path.string() + " is rendered with a different seed.");
+            }
+
+            Film partial(image.width, image.height);
+            partial.read(reader);
+            film.merge(partial);
+
+            ranges.emplace_back(header.first_spp, header.last_spp);
+            std::cout << "Merged samples [" << header.first_spp << ", " << header.last_spp << ") from " << path.string() << std::endl;
+        }
+
+        std::sort(ranges.begin(), ranges.end());
+        uint64_t end = 0;
+        for (const auto &[b, e] : ranges)
+        {
+            if (b < end)
+            {
+                throw std::runtime_error("Overlapping sample ranges in partial films.");
+            }
+            if (b > end)
+            {
+                std::cout << "Warning: samples [" << end << ", " << b << ") are missing." << std::endl;
+            }
+            end = e;
+        }
+
+        film.develop(image);
+        image.save(savename);
+        std::cout << "Saved merged image " << savename << ".tga with " << end << " samples per pixel" << std::endl;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "film.hpp"
+
+/**************************************************************************
+ Raw film of a partial render, which samples the range [first_spp, last_spp) 
+ of every pixel. Partial renders of the same scene and camera with the same 
+ seed take disjoint parts of the same sample sequences, so the sum of their 
+ films is the film of a single render of all ranges.
+***************************************************************************/
+namespace PartialFilm
+{
+    struct Header
+    {
+        uint64_t scene_key;
+        uint32_t seed;
+        uint64_t first_spp, last_spp;
+        std::string image_json; // image settings of the camera, used to tonemap the merged film
+    };
+
+    void write(const std::filesystem::path &path, const Header &header, const Film &film);
+
+    // Sums the films of the partial renders and saves the tonemapped result as savename.tga
+    void merge(const std::vector<std::filesystem::path> &paths, const std::string &savename);
+}
@@ -44,6 +44,28 @@ glm::dvec3 linear(const glm::dvec3 &in)
     return in;
 }
 
+// Polynomial approximation of the Turbo false color map by Anton Mikhailov, x in [0, 1] to sRGB
+// https://ai.googleblog.com/2019/08/turbo-improved-rainbow-colormap-for.html
+glm::dvec3 turbo(double x)
+{
+    constexpr glm::dvec4 red4(0.13572138, 4.61539260, -42.66032258, 132.13108234);
+    constexpr glm::dvec4 green4(0.09140261, 2.19418839, 4.84296658, -14.18503333);
+    constexpr glm::dvec4 blue4(0.10667330, 12.64194608, -60.58204836, 110.36276771);
+    constexpr glm::dvec2 red2(-152.94239396, 59.28637943);
+    constexpr glm::dvec2 green2(4.27729857, 2.82956604);
+    constexpr glm::dvec2 blue2(-89.90310912, 27.34824973);
+
+    x = glm::clamp(x, 0.0, 1.0);
+    glm::dvec4 v4(1.0, x, x * x, x * x * x);
+    glm::dvec2 v2 = glm::dvec2(v4.z, v4.w) * v4.z;
+
+    return glm::dvec3(
+        glm::dot(v4, red4) + glm::dot(v2, red2),
+        glm::dot(v4, green4) + glm::dot(v2, green2),
+        glm::dot(v4, blue4) + glm::dot(v2, blue2)
+    );
+}
+
 std::vector<uint8_t> truncate(const glm::dvec3 &in)
 {
     glm::dvec3 c = glm::clamp(in, glm::dvec3(0.0), glm::dvec3(1.0)) * std::nextafter(256.0, 0.0);
@@ -10,4 +10,6 @@ glm::dvec3 filmicACES(const glm::dvec3 &in);
 
 glm::dvec3 linear(const glm::dvec3 &in);
 
+glm::dvec3 turbo(double x);
+
 std::vector<uint8_t> truncate(const glm::dvec3 &in);
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "tile-server.hpp"
+
+#include <iostream>
+#include <chrono>
+
+#include "../sampling/sampler.hpp"
+#include "../integrator/integrator.hpp"
+
+TileServer::TileServer(Camera &camera, const std::string &address)
+    : camera(camera), listener(address)
+{
+    std::cout << "Waiting for workers on " << address << std::endl << std::endl;
+    accept_thread = std::make_unique<std::thread>(&TileServer::acceptThread, this);
+}
+
+TileServer::~TileServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    listener.shutdown();
+    accept_thread->join();
+
+    // Idle workers are sent an end message, but workers that are still loading the scene are disconnected
+    for (auto &connection : connections)
+    {
+        if (!connection->ready)
+        {
+            connection->socket->shutdown();
+        }
+    }
+
+    for (auto &thread : threads)
+    {
+        thread->join();
+    }
+}
+
+void TileServer::samplePass(const std::vector<Camera::Bucket> &buckets, size_t begin, size_t end)
+{
+    std::unique_lock<std::mutex> lock(m);
+    queue.assign(buckets.begin(), buckets.end());
+    pass_begin = begin;
+    pass_end = end;
+    num_remaining = buckets.size();
+    cv.notify_all();
+
+    while (num_remaining > 0)
+    {
+        cv.wait_for(lock, std::chrono::milliseconds(100));
+
+        // Buckets in flight are still merged when the deadline passes
+        if (camera.pastDeadline() && !queue.empty())
+        {
+            num_remaining -= queue.size();
+            queue.clear();
+        }
+    }
+}
+
+void TileServer::acceptThread()
+{
+    while (true)
+    {
+        auto connection = std::make_shared<Connection>();
+        try
+        {
+            connection->socket = std::make_shared<Socket>(listener.accept());
+        }
+        catch (const std::exception&)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m);
+        if (stopping) return;
+        connections.push_back(connection);
+        threads.push_back(std::make_unique<std::thread>(&TileServer::connectionThread, this, connection));
+    }
+}
+
+void TileServer::connectionThread(std::shared_ptr<Connection> connection)
+{
+    auto &socket = connection->socket;
+    try
+    {
+        socket->write(Message::Scene);
+        socket->write(std::vector<char>(camera.scene_json.begin(), camera.scene_json.end()));
+        socket->write<uint32_t>(camera.camera_idx);
+        socket->write<uint8_t>(camera.photon_map);
+        socket->write(camera.seed);
+
+        // The worker loads the scene before it replies
+        if (socket->read<Message>() != Message::Ready)
+        {
+            throw std::runtime_error("Unexpected message.");
+        }
+        connection->ready = true;
+
+        while (true)
+        {
+            Camera::Bucket bucket;
+            size_t begin, end;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (stopping) break;
+                bucket = queue.front();
+                queue.pop_front();
+                begin = pass_begin;
+                end = pass_end;
+            }
+
+            Film::Tile tile = camera.film.tile(bucket.min, bucket.max);
+            std::vector<uint32_t> tile_index = camera.bucketSampleIndex(bucket);
+            try
+            {
+                socket->write(Message::Task);
+                socket->write(bucket.min);
+                socket->write(bucket.max);
+                socket->write<uint64_t>(begin);
+                socket->write<uint64_t>(end);
+                socket->write(tile_index);
+
+                if (socket->read<Message>() != Message::Tile)
+                {
+                    throw std::runtime_error("Unexpected message.");
+                }
+                size_t num_pixels = tile_index.size(), tile_size = tile.data().size();
+                socket->read(tile_index, num_pixels);
+                socket->read(tile.data(), tile_size);
+                if (tile_index.size() != num_pixels || tile.data().size() != tile_size)
+                {
+                    throw std::runtime_error("Tile size mismatch.");
+                }
+            }
+            catch (const std::exception&)
+            {
+                std::lock_guard<std::mutex> lock(m);
+                queue.push_front(bucket);
+                cv.notify_all();
+                throw;
+            }
+
+            camera.mergeBucket(bucket, tile, tile_index);
+
+            std::lock_guard<std::mutex> lock(m);
+            num_remaining--;
+            cv.notify_all();
+        }
+
+        socket->write(Message::End);
+    }
+    catch (const std::exception &ex)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (!stopping)
+        {
+            std::cout << "\nLost connection to worker: " << ex.what() << std::endl;
+        }
+    }
+}
+
+void TileServer::worker(const std::string &address)
+{
+    std::mutex camera_mutex;
+    std::shared_ptr<Integrator> integrator;
+    std::shared_ptr<Camera> camera;
+    std::string integrator_key, camera_key;
+
+    auto workerThread = [&]()
+    {
+        while (true)
+        {
+            Socket socket;
+            try
+            {
+                socket = Socket::connect(address);
+            }
+            catch (const std::exception&)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+
+            try
+            {
+                if (socket.read<Message>() != Message::Scene)
+                {
+                    throw std::runtime_error("Unexpected message.");
+                }
+                std::vector<char> scene_json;
+                socket.read(scene_json);
+                uint32_t camera_idx = socket.read<uint32_t>();
+                bool photon_map = socket.read<uint8_t>();
+                uint32_t seed = socket.read<uint32_t>();
+
+                std::shared_ptr<Camera> cam;
+                {
+                    std::lock_guard<std::mutex> lock(camera_mutex);
+                    // The scene and photon maps are kept for all cameras of the scene
+                    std::string scene_key = std::string(scene_json.begin(), scene_json.end()) + (photon_map ? "photon_map" : "");
+                    // Cameras are never modified once shared, so other seeds get another camera
+                    std::string key = scene_key + std::to_string(camera_idx) + ":" + std::to_string(seed);
+                    if (!camera || key != camera_key)
+                    {
+                        camera.reset();
+                        nlohmann::json j = nlohmann::json::parse(scene_json.begin(), scene_json.end());
+                        if (!integrator || scene_key != integrator_key)
+                        {
+                            integrator.reset();
+                            integrator = Integrator::create(j, photon_map);
+                            integrator_key = scene_key;
+                        }
+                        camera = std::make_shared<Camera>(j, Option(Scene::path, "", camera_idx, photon_map), integrator);
+                        camera->time_limit = -1.0; // the coordinator decides when to stop
+                        camera->seed = seed;
+                        camera_key = key;
+                    }
+                    cam = camera;
+                }
+                socket.write(Message::Ready);
+
+                while (true)
+                {
+                    Message message = socket.read<Message>();
+                    if (message == Message::End) break;
+                    if (message != Message::Task)
+                    {
+                        throw std::runtime_error("Unexpected message.");
+                    }
+
+                    Camera::Bucket bucket;
+                    bucket.min = socket.read<glm::ivec2>();
+                    bucket.max = socket.read<glm::ivec2>();
+                    size_t begin = socket.read<uint64_t>();
+                    size_t end = socket.read<uint64_t>();
+                    glm::ivec2 dims = bucket.max - bucket.min;
+                    if (glm::any(glm::lessThan(bucket.min, glm::ivec2(0))) || glm::any(glm::lessThanEqual(dims, glm::ivec2(0))) ||
+                        (size_t)bucket.max.x > cam->image.width || (size_t)bucket.max.y > cam->image.height)
+                    {
+                        throw std::runtime_error("Invalid bucket.");
+                    }
+                    size_t num_pixels = (size_t)dims.x * dims.y;
+                    std::vector<uint32_t> tile_index;
+                    socket.read(tile_index, num_pixels);
+                    if (tile_index.size() != num_pixels)
+                    {
+                        throw std::runtime_error("Invalid bucket.");
+                    }
+
+                    Film::Tile tile = cam->film.tile(bucket.min, bucket.max);
+                    cam->sampleBucket(bucket, begin, end, tile, tile_index);
+
+                    socket.write(Message::Tile);
+                    socket.write(tile_index);
+                    socket.write(tile.data());
+                }
+            }
+            catch (const std::exception &ex)
+            {
+                std::cout << "Lost connection to coordinator: " << ex.what() << std::endl;
+            }
+        }
+    };
+
+    size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::cout << "Rendering buckets for " << address << " with " << num_threads << " threads" << std::endl;
+
+    std::vector<std::unique_ptr<std::thread>> threads(num_threads);
+    for (auto &thread : threads)
+    {
+        thread = std::make_unique<std::thread>(workerThread);
+    }
+    for (auto &thread : threads)
+    {
+        thread->join();
+    }
+}
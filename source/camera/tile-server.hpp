@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "camera.hpp"
+
+#include "../common/socket.hpp"
+
+/**************************************************************************
+ Coordinator of a distributed render. The camera owns the film, and the
+ server hands the buckets of each sample pass to connected worker
+ processes, which return the filtered tiles of the buckets. Each worker
+ connection has one bucket in flight at a time, and the bucket is queued
+ again if the connection is lost before its tile is returned.
+
+ Workers are started with --worker <address> and stay resident, so they
+ reconnect to the next coordinator on the same address and only load the
+ scene again if it has changed. The scene file is sent to the workers,
+ but the files it references must be available in the scenes directory
+ of each worker.
+***************************************************************************/
+class TileServer
+{
+public:
+    TileServer(Camera &camera, const std::string &address);
+    ~TileServer();
+
+    // Returns when all buckets are merged into the film or the deadline of the camera has passed
+    void samplePass(const std::vector<Camera::Bucket> &buckets, size_t begin, size_t end);
+
+    // Renders buckets for coordinators on address until the process is terminated
+    static void worker(const std::string &address);
+
+private:
+    enum class Message : uint8_t { Scene, Ready, Task, Tile, End };
+
+    struct Connection
+    {
+        std::shared_ptr<Socket> socket;
+        std::atomic_bool ready = false; // set when the worker has loaded the scene
+    };
+
+    void acceptThread();
+    void connectionThread(std::shared_ptr<Connection> connection);
+
+    Camera &camera;
+    Listener listener;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Camera::Bucket> queue;
+    size_t pass_begin = 0, pass_end = 0;
+    size_t num_remaining = 0; // buckets of the pass that are queued or in flight
+    bool stopping = false;
+
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<std::unique_ptr<std::thread>> threads;
+    std::unique_ptr<std::thread> accept_thread;
+};
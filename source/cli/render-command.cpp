@@ -0,0 +1,221 @@
+#include "render-command.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <filesystem>
+
+#include <nlohmann/json.hpp>
+
+#include "../camera/camera.hpp"
+#include "../integrator/integrator.hpp"
+#include "../common/option.hpp"
+#include "../common/util.hpp"
+
+namespace RenderCommand
+{
+    void printUsage(const std::string &program)
+    {
+        std::cout << "Usage: " << program << " --render <scene file> [options]\n\n"
+                  << "  --camera <index>         Camera to render, can be repeated. All cameras by default.\n"
+                  << "  --sqrtspp <n>            Square-rooted number of samples per pixel.\n"
+                  << "  --threads <n>            Number of render threads.\n"
+                  << "  --resolution <w>x<h>     Image resolution.\n"
+                  << "  --bvh <type>             BVH type: octree, binary_sah, quaternary_sah, lbvh or sbvh.\n"
+                  << "  --photons <n>            Photon map emissions.\n"
+                  << "  --path-tracer            Path trace scenes that define a photon map.\n"
+                  << "  --bvh-heatmap            Render the BVH traversal cost of the camera rays instead of radiance.\n"
+                  << "  --output <savename>      Image savename, suffixed with the camera index if several are rendered.\n"
+                  << "  --set <pointer>=<value>  Sets any field of the scene file, e.g. --set /cameras/0/f_stop=2.8\n"
+                  << "  --timings <file>         Writes the timings as JSON to file, or to stdout if file is -.\n";
+    }
+
+    int run(const std::vector<std::string> &args)
+    {
+        if (args.empty())
+        {
+            printUsage("monte-carlo-ray-tracer");
+            return -1;
+        }
+
+        std::filesystem::path path = std::filesystem::current_path() / args[0];
+        Scene::path = path.parent_path();
+
+        std::string output, timings_path;
+        std::vector<int> cameras;
+        bool path_tracer = false;
+        nlohmann::json parameters = nlohmann::json::object();
+
+        try
+        {
+            std::ifstream scene_file(path);
+            if (!scene_file)
+            {
+                throw std::runtime_error("Unable to open " + path.string());
+            }
+            nlohmann::json j;
+            scene_file >> j;
+            scene_file.close();
+
+            // Camera fields are applied to the selected cameras once they are known
+            nlohmann::json camera_overrides = nlohmann::json::object();
+
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                const std::string &arg = args[i];
+                if (arg == "--path-tracer")
+                {
+                    path_tracer = true;
+                    continue;
+                }
+                if (arg == "--bvh-heatmap")
+                {
+                    j["integrator"] = "bvh_heatmap";
+                    continue;
+                }
+                if (i + 1 >= args.size())
+                {
+                    throw std::runtime_error("Missing value of " + arg);
+                }
+                const std::string &value = args[++i];
+
+                if (arg == "--camera")
+                {
+                    cameras.push_back(std::stoi(value));
+                }
+                else if (arg == "--sqrtspp")
+                {
+                    camera_overrides["sqrtspp"] = std::stoul(value);
+                }
+                else if (arg == "--threads")
+                {
+                    j["num_render_threads"] = std::stoi(value);
+                }
+                else if (arg == "--resolution")
+                {
+                    size_t x = value.find('x');
+                    if (x == std::string::npos)
+                    {
+                        throw std::runtime_error("Invalid resolution " + value + ", expected <width>x<height>.");
+                    }
+                    camera_overrides["image"]["width"] = std::stoul(value.substr(0, x));
+                    camera_overrides["image"]["height"] = std::stoul(value.substr(x + 1));
+                }
+                else if (arg == "--bvh")
+                {
+                    j["bvh"]["type"] = value;
+                }
+                else if (arg == "--photons")
+                {
+                    if (j.find("photon_map") == j.end())
+                    {
+                        throw std::runtime_error("The scene has no photon map.");
+                    }
+                    j["photon_map"]["emissions"] = std::stoull(value);
+                }
+                else if (arg == "--output")
+                {
+                    output = value;
+                }
+                else if (arg == "--set")
+                {
+                    size_t eq = value.find('=');
+                    if (eq == std::string::npos)
+                    {
+                        throw std::runtime_error("Invalid override " + value + ", expected <pointer>=<value>.");
+                    }
+                    // Values that aren't valid JSON are set as strings
+                    nlohmann::json field = nlohmann::json::parse(value.substr(eq + 1), nullptr, false);
+                    if (field.is_discarded()) field = value.substr(eq + 1);
+                    j[nlohmann::json::json_pointer(value.substr(0, eq))] = field;
+                }
+                else if (arg == "--timings")
+                {
+                    timings_path = value;
+                    continue;
+                }
+                else
+                {
+                    throw std::runtime_error("Unknown option " + arg);
+                }
+
+                if (arg == "--camera" || arg == "--set")
+                {
+                    parameters[arg.substr(2)].push_back(value);
+                }
+                else
+                {
+                    parameters[arg.substr(2)] = value;
+                }
+            }
+
+            if (cameras.empty())
+            {
+                for (int i = 0; i < j.at("cameras").size(); i++)
+                {
+                    cameras.push_back(i);
+                }
+            }
+            for (int camera_idx : cameras)
+            {
+                nlohmann::json &c = j.at("cameras").at(camera_idx);
+                c.merge_patch(camera_overrides);
+                if (!output.empty())
+                {
+                    c["savename"] = cameras.size() > 1 ? output + "_" + std::to_string(camera_idx) : output;
+                }
+            }
+
+            auto ms = [](auto duration) { return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(); };
+
+            bool photon_map = j.find("photon_map") != j.end() && !path_tracer;
+            auto start = std::chrono::steady_clock::now();
+            std::shared_ptr<Integrator> integrator = Integrator::create(j, photon_map);
+            auto loaded = std::chrono::steady_clock::now();
+
+            nlohmann::json timings = {
+                { "scene", path.string() },
+                { "integrator", getOptional<std::string>(j, "integrator", photon_map ? "photon_mapper" : "path_tracer") },
+                { "threads", integrator->num_threads },
+                { "parameters", parameters },
+                { "load_ms", ms(loaded - start) },
+                { "cameras", nlohmann::json::array() }
+            };
+
+            for (int camera_idx : cameras)
+            {
+                Camera camera(j, Option(path, "", camera_idx, photon_map), integrator);
+                auto before = std::chrono::steady_clock::now();
+                camera.capture();
+                auto after = std::chrono::steady_clock::now();
+
+                double seconds = std::chrono::duration<double>(after - before).count();
+                timings["cameras"].push_back({
+                    { "camera", camera_idx },
+                    { "width", camera.image.width },
+                    { "height", camera.image.height },
+                    { "sqrtspp", camera.sqrtspp },
+                    { "samples", camera.numSamples() },
+                    { "render_ms", ms(after - before) },
+                    { "samples_per_second", camera.numSamples() / seconds },
+                    { "output", camera.savename + ".tga" }
+                });
+            }
+
+            if (timings_path == "-")
+            {
+                std::cout << timings.dump() << std::endl;
+            }
+            else if (!timings_path.empty())
+            {
+                std::ofstream(timings_path) << timings.dump(2) << std::endl;
+            }
+        }
+        catch (const std::exception &ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+}
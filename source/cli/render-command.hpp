@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**************************************************************************
+ Non-interactive rendering of a scene file for scripted runs:
+
+   monte-carlo-ray-tracer --render <scene file> [options]
+
+ The options override the corresponding fields of the scene file, and the 
+ timings of the render can be written as JSON. All selected cameras are 
+ rendered with the same loaded scene, BVH and photon maps.
+***************************************************************************/
+namespace RenderCommand
+{
+    // Arguments after --render, returns the exit code of the program
+    int run(const std::vector<std::string> &args);
+
+    void printUsage(const std::string &program);
+}
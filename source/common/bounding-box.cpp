@@ -71,6 +71,13 @@ void BoundingBox::merge(const glm::dvec3 &p)
     }
 }
 
+// Shrinks the bounding box to its intersection with BB, which is invalid if they don't overlap
+void BoundingBox::clip(const BoundingBox &BB)
+{
+    min = glm::max(min, BB.min);
+    max = glm::min(max, BB.max);
+}
+
 bool BoundingBox::valid() const
 {
     for (int i = 0; i < 3; i++)
@@ -18,6 +18,7 @@ struct BoundingBox
     double max_distance2(const glm::dvec3& p) const;
     void merge(const BoundingBox &BB);
     void merge(const glm::dvec3 &p);
+    void clip(const BoundingBox &BB);
     bool valid() const;
 
     glm::dvec3 min = glm::dvec3(std::numeric_limits<double>::max());
@@ -0,0 +1,142 @@
+#include "bundle.hpp"
+
+#include <bit>
+#include <algorithm>
+
+namespace Bundle
+{
+    static constexpr char magic[8] = { 'M', 'C', 'R', 'T', 'S', 'C', 'N', 'B' };
+
+    // Size of the contents before the trailer, followed by their hash seeded with the key
+    struct Trailer
+    {
+        uint64_t size, hash;
+    };
+
+    // 64-bit multiply-rotate hash, processes 8 bytes per step so that hashing large OBJ files is fast
+    uint64_t hash(const void* data, size_t size, uint64_t seed)
+    {
+        constexpr uint64_t k1 = 0x87c37b91114253d5, k2 = 0x4cf5ad432745937f;
+
+        const char* bytes = static_cast<const char*>(data);
+        uint64_t h = seed ^ (size * k1);
+
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, bytes + i, 8);
+            h = std::rotl(h ^ (std::rotl(w * k1, 31) * k2), 27) * 5 + 0x52dce729;
+        }
+
+        if (i < size)
+        {
+            uint64_t tail = 0;
+            std::memcpy(&tail, bytes + i, size - i);
+            h ^= std::rotl(tail * k1, 31) * k2;
+        }
+
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53;
+        h ^= h >> 33;
+        return h;
+    }
+
+    void prune(const std::filesystem::path &directory, size_t keep)
+    {
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> bundles;
+        for (const auto& entry : std::filesystem::directory_iterator(directory))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".bundle")
+            {
+                bundles.emplace_back(entry.last_write_time(), entry.path());
+            }
+        }
+
+        if (bundles.size() <= keep) return;
+
+        std::sort(bundles.begin(), bundles.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        for (size_t i = keep; i < bundles.size(); i++)
+        {
+            std::filesystem::remove(bundles[i].second);
+        }
+    }
+
+    Writer::Writer(const std::filesystem::path &path, uint64_t key)
+        : path(path), temp_path(path.string() + ".tmp"), key(key)
+    {
+        if (path.has_parent_path())
+        {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        file.open(temp_path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Unable to write " + temp_path.string());
+        }
+
+        file.write(magic, sizeof(magic));
+        write(version);
+        write(key);
+    }
+
+    void Writer::finish()
+    {
+        file.close();
+        if (!file)
+        {
+            throw std::runtime_error("Unable to write " + temp_path.string());
+        }
+
+        Trailer trailer;
+        {
+            MappedFile contents(temp_path);
+            trailer = { contents.size(), hash(contents.data(), contents.size(), key) };
+        }
+
+        file.open(temp_path, std::ios::binary | std::ios::app);
+        write(trailer);
+        file.close();
+        if (!file)
+        {
+            throw std::runtime_error("Unable to write " + temp_path.string());
+        }
+        std::filesystem::rename(temp_path, path);
+    }
+
+    Reader::Reader(const std::filesystem::path &path, uint64_t key) : file(path)
+    {
+        if (file.size() < sizeof(magic) || std::memcmp(file.data(), magic, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error("Invalid bundle file.");
+        }
+        offset = sizeof(magic);
+        end = file.size() >= sizeof(magic) + sizeof(Trailer) ? file.size() - sizeof(Trailer) : offset;
+
+        if (read<uint32_t>() != version || read<uint64_t>() != key)
+        {
+            throw std::runtime_error("Outdated bundle file.");
+        }
+
+        Trailer trailer;
+        std::memcpy(&trailer, file.data() + end, sizeof(Trailer));
+        if (trailer.size != end || trailer.hash != hash(file.data(), end, key))
+        {
+            throw std::runtime_error("Truncated or corrupt bundle file.");
+        }
+    }
+
+    const char* Reader::get(size_t size)
+    {
+        if (size > end - offset)
+        {
+            throw std::runtime_error("Truncated bundle file.");
+        }
+        const char* data = file.data() + offset;
+        offset += size;
+        return data;
+    }
+}
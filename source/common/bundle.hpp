@@ -0,0 +1,99 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include "mapped-file.hpp"
+
+/**************************************************************************
+ Binary scene bundle. The results of the expensive parts of scene loading,
+ i.e. the final mesh arrays and the BVH node arrays, are written as a flat 
+ sequence of raw arrays that is read back in the same order by memory 
+ mapping the bundle. Bundles are identified by a content hash (key) of the
+ geometry part of the scene file and all files it references, so a bundle 
+ for an old version of the scene is never read again and is eventually 
+ pruned. A trailer with the size and hash of the contents is appended when
+ the bundle is finished, so truncated or corrupt bundles are rejected when
+ opened rather than part way through reading them. The same format is used
+ for the film checkpoints of cameras.
+***************************************************************************/
+namespace Bundle
+{
+    // Incremented whenever the layout of the bundle or of any stored type changes
+    inline constexpr uint32_t version = 2;
+
+    uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+
+    // Removes all but the keep most recently modified .bundle files in directory
+    void prune(const std::filesystem::path &directory, size_t keep);
+
+    class Writer
+    {
+    public:
+        // Writes to a temporary file which replaces path in finish()
+        Writer(const std::filesystem::path &path, uint64_t key);
+
+        template<class T>
+        void write(const T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template<class T>
+        void write(const std::vector<T> &values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            write<uint64_t>(values.size());
+            file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+        // Appends the trailer and replaces path with the written file
+        void finish();
+
+    private:
+        std::filesystem::path path, temp_path;
+        std::ofstream file;
+        uint64_t key;
+    };
+
+    // Throws if the file isn't a complete bundle of the current version with the given key
+    class Reader
+    {
+    public:
+        Reader(const std::filesystem::path &path, uint64_t key);
+
+        template<class T>
+        T read()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value;
+            std::memcpy(&value, get(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        template<class T>
+        void read(std::vector<T> &values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            uint64_t size = read<uint64_t>();
+            if (size > (end - offset) / sizeof(T))
+            {
+                throw std::runtime_error("Truncated bundle file.");
+            }
+            values.resize(size);
+            std::memcpy(values.data(), get(size * sizeof(T)), size * sizeof(T));
+        }
+
+    private:
+        const char* get(size_t size);
+
+        MappedFile file;
+        size_t offset = 0, end = 0; // end of the contents, before the trailer
+    };
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+/***************************************************************************
+ Stack with fixed capacity that never allocates. The user is responsible for
+ making sure that the capacity is never exceeded, e.g. by computing the
+ largest stack size required by a tree traversal when the tree is built.
+****************************************************************************/
+template<class T, size_t N>
+class FixedStack
+{
+public:
+    static constexpr size_t capacity = N;
+
+    void push(const T& value) { S[size_++] = value; }
+    void pop() { size_--; }
+
+    const T& top() const { return S[size_ - 1]; }
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    void clear() { size_ = 0; }
+
+private:
+    std::array<T, N> S;
+    size_t size_ = 0;
+};
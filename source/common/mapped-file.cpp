@@ -0,0 +1,92 @@
+#include "mapped-file.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path &path)
+{
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        throw std::runtime_error("Unable to open " + path.string());
+    }
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size_ = (size_t)file_size.QuadPart;
+
+    // Empty files can't be mapped
+    if (size_ == 0) return;
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+    {
+        data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!data_)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Unable to map " + path.string());
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::runtime_error("Unable to open " + path.string());
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1)
+    {
+        close(fd);
+        throw std::runtime_error("Unable to read " + path.string());
+    }
+    size_ = (size_t)file_stat.st_size;
+
+    // Empty files can't be mapped
+    if (size_ > 0)
+    {
+        void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Unable to map " + path.string());
+        }
+        data_ = (const char*)mapped;
+    }
+
+    // The mapping stays valid after the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_) munmap((void*)data_, size_);
+}
+
+#endif
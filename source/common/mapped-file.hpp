@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <cstddef>
+
+/***************************************************************************
+ Read-only memory mapping of a whole file. The contents are paged in by the 
+ OS on demand, which avoids copying the file through a stream buffer. The
+ mapping is released when the object is destroyed.
+****************************************************************************/
+class MappedFile
+{
+public:
+    MappedFile(const std::filesystem::path &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
@@ -9,34 +9,126 @@
 
 #include "util.hpp"
 
+namespace
+{
+    /**************************************************************************
+     Only the cameras and photon map of a scene file are needed to list its
+     options, so all other top-level fields, e.g. large inline vertex arrays,
+     are discarded while they are parsed instead of being stored.
+    ***************************************************************************/
+    nlohmann::json parseOptionFields(const std::filesystem::path &path)
+    {
+        std::ifstream scene_file(path);
+        std::string field;
+        auto filter = [&field](int depth, nlohmann::json::parse_event_t event, nlohmann::json &parsed)
+        {
+            if (depth == 1 && event == nlohmann::json::parse_event_t::key)
+            {
+                field = parsed.get<std::string>();
+            }
+            return depth == 0 || field == "cameras" || field == "photon_map";
+        };
+        return nlohmann::json::parse(scene_file, filter);
+    }
+
+    std::vector<std::string> cameraDescriptions(const nlohmann::json &j)
+    {
+        std::vector<std::string> cameras;
+        for (const auto& c : j.at("cameras"))
+        {
+            glm::dvec3 eye = c.at("eye");
+            double f = c.at("focal_length");
+            double s = c.at("sensor_width");
+            std::stringstream ss;
+            ss << "Eye: " << std::fixed << std::setprecision(0) << "(" << eye.x << " " << eye.y << " " << eye.z << "), ";
+            ss << "Focal length: " << int(f) << "mm (" << int(s) << "mm)";
+            cameras.push_back(ss.str());
+        }
+        return cameras;
+    }
+}
+
+/**************************************************************************
+ The options of each scene file are cached in an index next to the scene 
+ bundles, keyed by the size and modification time of the file. Startup 
+ then only has to parse the scene files that have changed since the last 
+ run. The index is a cache, so failing to read or write it is not an error.
+***************************************************************************/
 std::vector<Option> availible(std::filesystem::path path)
 {
+    std::filesystem::path index_path = path / "bundles" / "scene-index.json";
+    nlohmann::json index = nlohmann::json::object();
+    {
+        std::ifstream index_file(index_path);
+        if (index_file)
+        {
+            index = nlohmann::json::parse(index_file, nullptr, false);
+            if (!index.is_object()) index = nlohmann::json::object();
+        }
+    }
+
+    bool index_changed = false;
     std::vector<Option> options;
     for (const auto& file : std::filesystem::directory_iterator(path))
     {
         if (!file.path().has_extension() || file.path().extension() != ".json")
             continue;
 
-        std::ifstream scene_file(file.path());
-        nlohmann::json j;
-        scene_file >> j;
+        std::string name = file.path().filename().string();
+        auto write_time = std::filesystem::last_write_time(file.path()).time_since_epoch().count();
+        auto size = std::filesystem::file_size(file.path());
 
-        bool photon_map = j.find("photon_map") != j.end();
+        auto entry = index.find(name);
+        if (entry == index.end() || getOptional(*entry, "write_time", decltype(write_time)(0)) != write_time ||
+            getOptional(*entry, "size", decltype(size)(0)) != size)
+        {
+            nlohmann::json j = parseOptionFields(file.path());
+            index[name] = {
+                { "write_time", write_time },
+                { "size", size },
+                { "photon_map", j.find("photon_map") != j.end() },
+                { "cameras", cameraDescriptions(j) }
+            };
+            entry = index.find(name);
+            index_changed = true;
+        }
 
+        bool photon_map = entry->at("photon_map");
         int i = 0;
-        for (const auto& c : j.at("cameras"))
+        for (const auto& camera : entry->at("cameras"))
         {
-            glm::dvec3 eye = c.at("eye");
-            double f = c.at("focal_length");
-            double s = c.at("sensor_width");
-            std::stringstream ss;
-            ss << "Eye: " << std::fixed << std::setprecision(0) << "(" << eye.x << " " << eye.y << " " << eye.z << "), ";
-            ss << "Focal length: " << int(f) << "mm (" << int(s) << "mm)";
-            options.emplace_back(file.path(), ss.str(), i, photon_map);
+            options.emplace_back(file.path(), camera.get<std::string>(), i, photon_map);
             i++;
         }
-        scene_file.close();
     }
+
+    // Removed scene files are dropped from the index
+    for (auto it = index.begin(); it != index.end();)
+    {
+        if (!std::filesystem::exists(path / it.key()))
+        {
+            it = index.erase(it);
+            index_changed = true;
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    if (index_changed)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(index_path.parent_path(), ec);
+        std::filesystem::path temp_path = index_path.string() + ".tmp";
+        std::ofstream index_file(temp_path);
+        if (index_file << index.dump(2))
+        {
+            index_file.close();
+            std::filesystem::rename(temp_path, index_path, ec);
+        }
+    }
+
     return options;
 }
 
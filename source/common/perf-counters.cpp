@@ -0,0 +1,68 @@
+#include "perf-counters.hpp"
+
+#include <numeric>
+
+PerfCounters& PerfCounters::operator+=(const PerfCounters &other)
+{
+    for (size_t i = 0; i < max_depth; i++)
+    {
+        rays[i] += other.rays[i];
+    }
+    shadow_rays += other.shadow_rays;
+    occluded_shadow_rays += other.occluded_shadow_rays;
+    nodes_visited += other.nodes_visited;
+    primitives_tested += other.primitives_tested;
+    knn_queries += other.knn_queries;
+    photons_visited += other.photons_visited;
+    return *this;
+}
+
+nlohmann::json PerfCounters::toJSON(double seconds, size_t num_samples) const
+{
+    auto ratio = [](double a, double b) { return b > 0.0 ? a / b : 0.0; };
+
+    uint64_t camera_rays = rays[0];
+    uint64_t secondary_rays = std::accumulate(rays.begin() + 1, rays.end(), uint64_t(0));
+    uint64_t total_rays = camera_rays + secondary_rays + shadow_rays;
+
+    // Every path traces one ray at each depth until it ends, so the number of paths 
+    // that end after n rays is the difference between the rays at depth n - 1 and n.
+    std::vector<uint64_t> path_lengths(max_depth + 1, 0);
+    for (size_t n = 1; n < max_depth; n++)
+    {
+        path_lengths[n] = rays[n - 1] - rays[n];
+    }
+    path_lengths[max_depth] = rays[max_depth - 1];
+
+    return {
+        { "render_seconds", seconds },
+        { "samples", num_samples },
+        { "samples_per_second", ratio(num_samples, seconds) },
+        { "rays", {
+            { "camera", camera_rays },
+            { "secondary", secondary_rays },
+            { "shadow", shadow_rays },
+            { "total", total_rays },
+            { "per_second", ratio(total_rays, seconds) },
+            { "per_sample", ratio(total_rays, num_samples) }
+        } },
+        { "shadow_rays", {
+            { "traced", shadow_rays },
+            { "occluded", occluded_shadow_rays },
+            { "occlusion_rate", ratio(occluded_shadow_rays, shadow_rays) }
+        } },
+        { "bvh", {
+            { "nodes_visited", nodes_visited },
+            { "primitives_tested", primitives_tested },
+            { "nodes_per_ray", ratio(nodes_visited, total_rays) },
+            { "primitives_per_ray", ratio(primitives_tested, total_rays) }
+        } },
+        { "photon_map", {
+            { "knn_queries", knn_queries },
+            { "photons_visited", photons_visited },
+            { "photons_per_query", ratio(photons_visited, knn_queries) }
+        } },
+        // Index n is the number of paths that ended after tracing n rays, the last index includes longer paths
+        { "path_lengths", path_lengths }
+    };
+}
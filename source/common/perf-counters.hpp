@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <nlohmann/json.hpp>
+
+/**************************************************************************
+ Performance counters of one thread. Each thread only increments its own
+ thread_local counters, so counting costs no synchronization in the hot 
+ loops, and the render threads add their counters to the statistics of 
+ the camera when they finish. Counting is compiled out when the 
+ PERF_COUNTERS CMake option is disabled.
+***************************************************************************/
+struct PerfCounters
+{
+#ifdef PERF_COUNTERS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    static constexpr size_t max_depth = 32;
+
+    // Rays traced at each path depth, the last bin also counts all deeper rays
+    std::array<uint64_t, max_depth> rays{};
+
+    uint64_t shadow_rays = 0, occluded_shadow_rays = 0;
+    uint64_t nodes_visited = 0, primitives_tested = 0;
+    uint64_t knn_queries = 0, photons_visited = 0;
+
+    // Counters of the calling thread
+    static PerfCounters& local()
+    {
+        static thread_local PerfCounters counters;
+        return counters;
+    }
+
+    static void add(uint64_t PerfCounters::* counter, uint64_t n = 1)
+    {
+        if constexpr (enabled) local().*counter += n;
+    }
+
+    static void addRay(uint16_t depth)
+    {
+        if constexpr (enabled) local().rays[depth < max_depth ? depth : max_depth - 1]++;
+    }
+
+    // Counts the nodes and primitives of one BVH traversal, which are added to the thread counters on destruction
+    struct Traversal
+    {
+        ~Traversal()
+        {
+            add(&PerfCounters::nodes_visited, nodes);
+            add(&PerfCounters::primitives_tested, primitives);
+        }
+        uint64_t nodes = 0, primitives = 0;
+    };
+
+    PerfCounters& operator+=(const PerfCounters &other);
+
+    // Totals and derived rates, with render time and samples from the camera
+    nlohmann::json toJSON(double seconds, size_t num_samples) const;
+};
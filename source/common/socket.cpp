@@ -0,0 +1,341 @@
+#include "socket.hpp"
+
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#endif
+
+namespace
+{
+#ifdef _WIN32
+    void closeHandle(intptr_t handle)
+    {
+        closesocket((SOCKET)handle);
+    }
+
+    void startup()
+    {
+        static std::once_flag flag;
+        std::call_once(flag, []()
+        {
+            WSADATA data;
+            if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+            {
+                throw std::runtime_error("Unable to initialize Winsock.");
+            }
+        });
+    }
+
+    constexpr int send_flags = 0;
+#else
+    void closeHandle(intptr_t handle)
+    {
+        close((int)handle);
+    }
+
+    void startup() { }
+
+    // Writing to a closed connection should throw rather than raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+    constexpr int send_flags = MSG_NOSIGNAL;
+#else
+    constexpr int send_flags = 0;
+#endif
+#endif
+
+    bool isUnix(const std::string &address)
+    {
+        return address.rfind("unix:", 0) == 0;
+    }
+
+    struct AddrInfoDeleter
+    {
+        void operator()(addrinfo* info) const { freeaddrinfo(info); }
+    };
+
+    std::unique_ptr<addrinfo, AddrInfoDeleter> resolve(const std::string &address, bool passive)
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            throw std::runtime_error("Invalid socket address " + address + ", expected host:port.");
+        }
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo* info = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info) != 0)
+        {
+            throw std::runtime_error("Unable to resolve " + address);
+        }
+        return std::unique_ptr<addrinfo, AddrInfoDeleter>(info);
+    }
+
+#ifndef _WIN32
+    sockaddr_un unixAddress(const std::string &address)
+    {
+        std::string path = address.substr(5);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            throw std::runtime_error("Unix socket path is too long: " + path);
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+#endif
+
+    // Tiles are sent as soon as they are written rather than being delayed by Nagle's algorithm
+    void setNoDelay(intptr_t handle)
+    {
+        int flag = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+    }
+}
+
+Socket Socket::connect(const std::string &address)
+{
+    startup();
+
+    if (isUnix(address))
+    {
+#ifdef _WIN32
+        throw std::runtime_error("Unix domain sockets are not supported on this platform.");
+#else
+        sockaddr_un addr = unixAddress(address);
+        intptr_t handle = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (handle == -1 || ::connect(handle, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            if (handle != -1) closeHandle(handle);
+            throw std::runtime_error("Unable to connect to " + address);
+        }
+        return Socket(handle);
+#endif
+    }
+
+    auto info = resolve(address, false);
+    for (addrinfo* i = info.get(); i; i = i->ai_next)
+    {
+        intptr_t handle = (intptr_t)socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+        if (handle == -1) continue;
+        if (::connect(handle, i->ai_addr, (int)i->ai_addrlen) == 0)
+        {
+            setNoDelay(handle);
+            return Socket(handle);
+        }
+        closeHandle(handle);
+    }
+    throw std::runtime_error("Unable to connect to " + address);
+}
+
+Socket::~Socket()
+{
+    if (handle != -1) closeHandle(handle);
+}
+
+Socket::Socket(Socket &&other) noexcept : handle(other.handle)
+{
+    other.handle = -1;
+}
+
+Socket& Socket::operator=(Socket &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (handle != -1) closeHandle(handle);
+        handle = other.handle;
+        other.handle = -1;
+    }
+    return *this;
+}
+
+void Socket::shutdown()
+{
+#ifdef _WIN32
+    ::shutdown((SOCKET)handle, SD_BOTH);
+#else
+    ::shutdown((int)handle, SHUT_RDWR);
+#endif
+}
+
+void Socket::setTimeout(double seconds)
+{
+#ifdef _WIN32
+    DWORD timeout = (DWORD)(seconds * 1000.0);
+#else
+    timeval timeout;
+    timeout.tv_sec = (time_t)seconds;
+    timeout.tv_usec = (suseconds_t)((seconds - timeout.tv_sec) * 1e6);
+#endif
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+void Socket::send(const void* data, size_t size)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        int chunk = (int)std::min<size_t>(size, 1 << 30);
+        auto sent = ::send(handle, ptr, chunk, send_flags);
+        if (sent <= 0)
+        {
+            throw std::runtime_error("Connection closed.");
+        }
+        ptr += sent;
+        size -= sent;
+    }
+}
+
+void Socket::receive(void* data, size_t size)
+{
+    char* ptr = static_cast<char*>(data);
+    while (size > 0)
+    {
+        int chunk = (int)std::min<size_t>(size, 1 << 30);
+        auto received = ::recv(handle, ptr, chunk, 0);
+        if (received == 0)
+        {
+            throw std::runtime_error("Connection closed.");
+        }
+        if (received < 0)
+        {
+            throw std::runtime_error("Connection closed or timed out.");
+        }
+        ptr += received;
+        size -= received;
+    }
+}
+
+Listener::Listener(const std::string &address)
+{
+    startup();
+
+    if (isUnix(address))
+    {
+#ifdef _WIN32
+        throw std::runtime_error("Unix domain sockets are not supported on this platform.");
+#else
+        sockaddr_un addr = unixAddress(address);
+
+        // Replace a socket left behind by an earlier listener, but never any other kind of file
+        struct stat st;
+        if (stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            std::remove(addr.sun_path);
+        }
+
+        handle = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (handle == -1 || bind(handle, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(handle, SOMAXCONN) != 0)
+        {
+            if (handle != -1) closeHandle(handle);
+            throw std::runtime_error("Unable to listen on " + address);
+        }
+        unix_path = addr.sun_path;
+#endif
+    }
+    else
+    {
+        auto info = resolve(address, true);
+        for (addrinfo* i = info.get(); i; i = i->ai_next)
+        {
+            handle = (intptr_t)socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+            if (handle == -1) continue;
+
+            int flag = 1;
+            setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&flag, sizeof(flag));
+            if (bind(handle, i->ai_addr, (int)i->ai_addrlen) == 0 && listen(handle, SOMAXCONN) == 0)
+            {
+                break;
+            }
+            closeHandle(handle);
+            handle = -1;
+        }
+        if (handle == -1)
+        {
+            throw std::runtime_error("Unable to listen on " + address);
+        }
+    }
+
+#ifndef _WIN32
+    if (pipe(wake) != 0)
+    {
+        closeHandle(handle);
+        if (!unix_path.empty()) std::remove(unix_path.c_str());
+        throw std::runtime_error("Unable to listen on " + address);
+    }
+#endif
+}
+
+Listener::~Listener()
+{
+    if (handle != -1) closeHandle(handle);
+#ifndef _WIN32
+    if (!unix_path.empty()) std::remove(unix_path.c_str());
+    close(wake[0]);
+    close(wake[1]);
+#endif
+}
+
+Socket Listener::accept()
+{
+#ifndef _WIN32
+    /**************************************************************************
+    Shutting down a listening socket only wakes a blocked accept on Linux, so
+    wait on the listener together with the self-pipe that shutdown writes to.
+    **************************************************************************/
+    pollfd fds[2] = { { (int)handle, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+    while (poll(fds, 2, -1) < 0)
+    {
+        if (errno != EINTR) throw std::runtime_error("Listener closed.");
+    }
+    if (fds[1].revents)
+    {
+        throw std::runtime_error("Listener closed.");
+    }
+#endif
+    intptr_t client = (intptr_t)::accept(handle, nullptr, nullptr);
+    if (client == -1)
+    {
+        throw std::runtime_error("Listener closed.");
+    }
+    if (unix_path.empty()) setNoDelay(client);
+    return Socket(client);
+}
+
+void Listener::shutdown()
+{
+#ifdef _WIN32
+    closesocket((SOCKET)handle);
+    handle = -1;
+#else
+    char byte = 0;
+    if (::write(wake[1], &byte, 1) != 1)
+    {
+        ::shutdown((int)handle, SHUT_RDWR);
+    }
+#endif
+}
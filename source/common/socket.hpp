@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/***************************************************************************
+ Blocking stream socket with the same raw read/write interface as the scene
+ bundles. Addresses are either "host:port" for TCP or "unix:path" for Unix
+ domain sockets. Values are sent in host byte order, so both ends must have
+ the same endianness. All errors, including a closed connection, throw.
+****************************************************************************/
+class Socket
+{
+public:
+    static Socket connect(const std::string &address);
+
+    Socket() { }
+    ~Socket();
+
+    Socket(Socket &&other) noexcept;
+    Socket& operator=(Socket &&other) noexcept;
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    template<class T>
+    void write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        send(&value, sizeof(T));
+    }
+
+    template<class T>
+    void write(const std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write<uint64_t>(values.size());
+        send(values.data(), values.size() * sizeof(T));
+    }
+
+    template<class T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        receive(&value, sizeof(T));
+        return value;
+    }
+
+    template<class T>
+    void read(std::vector<T> &values, size_t max_size = SIZE_MAX)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        uint64_t size = read<uint64_t>();
+        if (size > max_size)
+        {
+            throw std::runtime_error("Unexpected message size.");
+        }
+        values.resize(size);
+        receive(values.data(), size * sizeof(T));
+    }
+
+    // Unblocks reads and writes of other threads, which then throw
+    void shutdown();
+
+    // Makes reads and writes that block for longer than seconds throw, 0 blocks indefinitely
+    void setTimeout(double seconds);
+
+private:
+    friend class Listener;
+
+    explicit Socket(intptr_t handle) : handle(handle) { }
+
+    void send(const void* data, size_t size);
+    void receive(void* data, size_t size);
+
+    intptr_t handle = -1;
+};
+
+class Listener
+{
+public:
+    Listener(const std::string &address);
+    ~Listener();
+
+    Listener(const Listener&) = delete;
+    Listener& operator=(const Listener&) = delete;
+
+    // Throws once the listener is shut down
+    Socket accept();
+
+    // Unblocks accept in other threads
+    void shutdown();
+
+private:
+    intptr_t handle = -1;
+    std::string unix_path;
+    int wake[2] = { -1, -1 }; // self-pipe written by shutdown to wake accept, unused on Windows
+};
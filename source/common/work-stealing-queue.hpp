@@ -0,0 +1,113 @@
+/***************************************************
+A thread safe work queue where each thread has its
+own deque of work. Threads take work from the front
+of their own deque, and steal work from the back of
+the fullest deque when their own deque is empty.
+***************************************************/
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+template <class T>
+class WorkStealingQueue
+{
+public:
+    // Each thread starts with a consecutive run of items, which preserves the locality of the item order
+    WorkStealingQueue(const std::vector<T>& items, size_t num_threads)
+        : queues(std::max<size_t>(num_threads, 1)), remaining(items.size())
+    {
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            queues[i * queues.size() / items.size()].items.push_back(items[i]);
+        }
+    }
+
+    bool getWork(size_t thread, T& item)
+    {
+        if (queues[thread].popFront(item))
+        {
+            remaining--;
+            return true;
+        }
+
+        while (remaining > 0)
+        {
+            size_t victim = thread, max_size = 0;
+            for (size_t i = 0; i < queues.size(); i++)
+            {
+                size_t size = queues[i].size();
+                if (size > max_size)
+                {
+                    max_size = size;
+                    victim = i;
+                }
+            }
+            if (max_size == 0) break;
+
+            if (queues[victim].popBack(item))
+            {
+                remaining--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds work to the front of the deque of thread, e.g. the parts of a split work item
+    void push(size_t thread, const T& item)
+    {
+        queues[thread].pushFront(item);
+        remaining++;
+    }
+
+    // Number of items left in all deques
+    size_t size() const
+    {
+        return remaining;
+    }
+
+private:
+    struct Deque
+    {
+        bool popFront(T& item)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (items.empty()) return false;
+            item = items.front();
+            items.pop_front();
+            return true;
+        }
+
+        bool popBack(T& item)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (items.empty()) return false;
+            item = items.back();
+            items.pop_back();
+            return true;
+        }
+
+        void pushFront(const T& item)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            items.push_front(item);
+        }
+
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock(m);
+            return items.size();
+        }
+
+        std::deque<T> items;
+        std::mutex m;
+    };
+
+    std::vector<Deque> queues;
+    std::atomic_size_t remaining;
+};
@@ -0,0 +1,193 @@
+#include "render-daemon.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "../camera/camera.hpp"
+#include "../integrator/integrator.hpp"
+#include "../common/util.hpp"
+#include "../common/format.hpp"
+
+namespace
+{
+    // Resident memory of the process in bytes, or 0 where it isn't available
+    size_t residentMemory()
+    {
+#ifdef __linux__
+        std::ifstream statm("/proc/self/statm");
+        size_t size, resident;
+        if (statm >> size >> resident)
+        {
+            return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+#endif
+        return 0;
+    }
+
+    void writeJSON(Socket &socket, const nlohmann::json &j)
+    {
+        std::string s = j.dump();
+        socket.write(std::vector<char>(s.begin(), s.end()));
+    }
+
+    nlohmann::json readJSON(Socket &socket)
+    {
+        std::vector<char> s;
+        socket.read(s, size_t(1) << 24);
+        return nlohmann::json::parse(s.begin(), s.end());
+    }
+
+    // Resolves path relative to directory, and throws if the result is outside of directory
+    std::filesystem::path resolveInside(const std::filesystem::path &directory, const std::string &path)
+    {
+        std::filesystem::path dir = std::filesystem::weakly_canonical(directory);
+        std::filesystem::path resolved = std::filesystem::weakly_canonical(dir / path);
+        std::filesystem::path relative = resolved.lexically_relative(dir);
+        if (relative.empty() || relative == "." || *relative.begin() == "..")
+        {
+            throw std::runtime_error("Path " + path + " is outside of " + dir.string());
+        }
+        return resolved;
+    }
+
+    std::string loopbackByDefault(const std::string &address)
+    {
+        return address.rfind(":", 0) == 0 ? "127.0.0.1" + address : address;
+    }
+}
+
+RenderDaemon::RenderDaemon(const std::string &address, size_t cache_budget, const std::filesystem::path &output_path)
+    : cache_budget(cache_budget), output_path(output_path), listener(loopbackByDefault(address))
+{
+    std::cout << "Render daemon listening on " << loopbackByDefault(address) << " with a scene cache of "
+              << Format::largeNumber(cache_budget >> 20) << " MB" << std::endl;
+}
+
+void RenderDaemon::run()
+{
+    while (true)
+    {
+        Socket socket = listener.accept();
+        try
+        {
+            // Requests are served one at a time, so a client that stalls mustn't block the others
+            socket.setTimeout(request_timeout);
+            nlohmann::json request = readJSON(socket);
+            nlohmann::json reply;
+            try
+            {
+                reply = render(request);
+            }
+            catch (const std::exception &ex)
+            {
+                reply = { { "status", "error" }, { "message", ex.what() } };
+                std::cout << "Render request failed: " << ex.what() << std::endl;
+            }
+            writeJSON(socket, reply);
+        }
+        catch (const std::exception &ex)
+        {
+            std::cout << "Invalid render request: " << ex.what() << std::endl;
+        }
+    }
+}
+
+nlohmann::json RenderDaemon::submit(const std::string &address, const nlohmann::json &request)
+{
+    Socket socket = Socket::connect(address);
+    writeJSON(socket, request);
+    return readJSON(socket);
+}
+
+nlohmann::json RenderDaemon::render(const nlohmann::json &request)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::filesystem::path path = resolveInside(Scene::path, request.at("scene").get<std::string>());
+    std::ifstream scene_file(path);
+    if (!scene_file)
+    {
+        throw std::runtime_error("Unable to open " + path.string());
+    }
+    nlohmann::json j;
+    scene_file >> j;
+    scene_file.close();
+
+    int camera_idx = getOptional(request, "camera", 0);
+    nlohmann::json &c = j.at("cameras").at(camera_idx);
+    if (request.find("overrides") != request.end())
+    {
+        // Requests can't make the daemon listen for workers
+        if (request.at("overrides").contains("server"))
+        {
+            throw std::runtime_error("Render requests can't override the server of the camera.");
+        }
+        c.merge_patch(request.at("overrides"));
+    }
+    if (request.find("sqrtspp") != request.end())
+    {
+        c["sqrtspp"] = request.at("sqrtspp");
+    }
+    if (request.find("output") != request.end())
+    {
+        c["savename"] = request.at("output");
+    }
+    c["savename"] = resolveInside(output_path, c.at("savename").get<std::string>()).string();
+
+    bool photon_map = getOptional(request, "photon_map", j.find("photon_map") != j.end());
+
+    bool cached;
+    auto shared_integrator = integrator(path, j, photon_map, cached);
+    auto loaded = std::chrono::steady_clock::now();
+
+    Camera camera(j, Option(path, "", camera_idx, photon_map), shared_integrator);
+    camera.capture();
+    auto rendered = std::chrono::steady_clock::now();
+
+    auto ms = [](auto duration) { return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(); };
+    return {
+        { "status", "ok" },
+        { "output", camera.savename + ".tga" },
+        { "cached", cached },
+        { "load_ms", ms(loaded - start) },
+        { "render_ms", ms(rendered - loaded) }
+    };
+}
+
+std::shared_ptr<Integrator> RenderDaemon::integrator(const std::filesystem::path &path, const nlohmann::json &j, bool photon_map, bool &cached)
+{
+    // Edited scene files are loaded again, and the stale entry is eventually evicted
+    auto write_time = std::filesystem::last_write_time(path).time_since_epoch().count();
+    std::string key = std::filesystem::absolute(path).string() + ":" + std::to_string(write_time) + (photon_map ? ":photon_map" : "");
+
+    auto entry = std::find_if(cache.begin(), cache.end(), [&](const CacheEntry &e) { return e.key == key; });
+    cached = entry != cache.end();
+    if (cached)
+    {
+        cache.splice(cache.begin(), cache, entry);
+        return cache.front().integrator;
+    }
+
+    size_t before = residentMemory();
+    auto integrator = Integrator::create(j, photon_map);
+    size_t after = residentMemory();
+
+    cache.push_front({ key, integrator, after > before ? after - before : 0 });
+    cache_size += cache.front().size;
+
+    // The newest entry is kept even if it exceeds the budget on its own
+    while (cache_size > cache_budget && cache.size() > 1)
+    {
+        std::cout << "Evicting " << cache.back().key << " from scene cache" << std::endl;
+        cache_size -= cache.back().size;
+        cache.pop_back();
+    }
+
+    return integrator;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <filesystem>
+
+#include <nlohmann/json.hpp>
+
+#include "../common/socket.hpp"
+
+class Integrator;
+
+/**************************************************************************
+ Long-running render server. Render requests are received as JSON over a
+ socket and rendered one at a time, e.g.
+
+   { "scene": "pipes.json", "camera": 0, "sqrtspp": 2, "output": "out/pipes",
+     "overrides": { "image": { "width": 480, "height": 270 } } }
+
+ where the scene file is relative to the scenes directory, overrides is
+ merged into the camera and output replaces its savename. Requests can't 
+ read scene files outside the scenes directory or write images outside 
+ the output directory, which savenames are relative to. The integrators,
+ i.e. the loaded scenes, BVHs and photon maps, of recently rendered scene
+ files are kept in a cache that evicts the least recently used ones when
+ their total memory exceeds the cache budget, so repeated renders of a
+ scene start tracing immediately. The reply is a JSON object with a
+ "status" of either "ok" or "error".
+***************************************************************************/
+class RenderDaemon
+{
+public:
+    // TCP addresses without a host, e.g. ":8000", only listen on the loopback interface
+    RenderDaemon(const std::string &address, size_t cache_budget, const std::filesystem::path &output_path);
+
+    // Serves render requests until the process is terminated
+    void run();
+
+    // Sends a render request to the daemon on address and returns its reply
+    static nlohmann::json submit(const std::string &address, const nlohmann::json &request);
+
+private:
+    nlohmann::json render(const nlohmann::json &request);
+
+    std::shared_ptr<Integrator> integrator(const std::filesystem::path &path, const nlohmann::json &j, bool photon_map, bool &cached);
+
+    struct CacheEntry
+    {
+        std::string key;
+        std::shared_ptr<Integrator> integrator;
+        size_t size; // bytes, measured as the growth of resident memory while loading
+    };
+
+    std::list<CacheEntry> cache; // most recently used first
+    size_t cache_size = 0, cache_budget;
+
+    std::filesystem::path output_path;
+
+    // Seconds that a client may stall while sending a request or receiving the reply
+    static constexpr double request_timeout = 10.0;
+
+    Listener listener;
+};
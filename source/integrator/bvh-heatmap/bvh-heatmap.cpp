@@ -0,0 +1,28 @@
+#include "bvh-heatmap.hpp"
+
+#include "../../common/perf-counters.hpp"
+
+BVHHeatmap::BVHHeatmap(const nlohmann::json& j) : Integrator(j)
+{
+    if (!PerfCounters::enabled)
+    {
+        throw std::runtime_error("The BVH heatmap integrator requires a build with the PERF_COUNTERS option.");
+    }
+}
+
+glm::dvec3 BVHHeatmap::sampleRay(Ray ray)
+{
+    const PerfCounters &counters = PerfCounters::local();
+    uint64_t nodes = counters.nodes_visited, primitives = counters.primitives_tested;
+
+    scene.intersect(ray);
+
+    return glm::dvec3(counters.nodes_visited - nodes, counters.primitives_tested - primitives, 0.0);
+}
+
+void BVHHeatmap::saveImage(const Image& image, const std::string& savename) const
+{
+    image.saveFalseColor(savename, 0);
+    image.saveFalseColor(savename + "_primitives", 1);
+    image.savePFM(savename);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <glm/vec3.hpp>
+
+#include "../integrator.hpp"
+
+/**************************************************************************
+ Debug integrator that renders the cost of tracing the camera rays instead
+ of radiance. The red channel of each sample is the number of BVH nodes 
+ visited and the green channel the number of primitives tested by the 
+ camera ray, which are averaged per pixel by the film like any radiance. 
+ The image is saved as false color heatmaps, savename.tga for the nodes 
+ and savename_primitives.tga for the primitives, and as the raw averages 
+ in savename.pfm. Selected with "integrator": "bvh_heatmap" in the scene 
+ file, and requires the PERF_COUNTERS build option.
+***************************************************************************/
+class BVHHeatmap : public Integrator
+{
+public:
+    BVHHeatmap(const nlohmann::json& j);
+
+    virtual glm::dvec3 sampleRay(Ray ray);
+
+    virtual void saveImage(const Image& image, const std::string& savename) const;
+};
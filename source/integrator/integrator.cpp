@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <thread>
+#include <algorithm>
 
 #include <glm/gtx/norm.hpp>
 
@@ -14,6 +15,28 @@
 #include "../surface/surface.hpp"
 #include "../ray/interaction.hpp"
 #include "../material/fresnel.hpp"
+#include "path-tracer/path-tracer.hpp"
+#include "photon-mapper/photon-mapper.hpp"
+#include "bvh-heatmap/bvh-heatmap.hpp"
+
+std::shared_ptr<Integrator> Integrator::create(const nlohmann::json &j, bool photon_map)
+{
+    std::string type = getOptional<std::string>(j, "integrator", "");
+    std::transform(type.begin(), type.end(), type.begin(), toupper);
+    if (type == "BVH_HEATMAP")
+    {
+        return std::make_shared<BVHHeatmap>(j);
+    }
+    if (!type.empty())
+    {
+        throw std::runtime_error("Unknown integrator " + getOptional<std::string>(j, "integrator", ""));
+    }
+    if (photon_map)
+    {
+        return std::make_shared<PhotonMapper>(j);
+    }
+    return std::make_shared<PathTracer>(j);
+}
 
 Integrator::Integrator(const nlohmann::json &j) : scene(j)
 {
@@ -65,14 +88,14 @@ glm::dvec3 Integrator::sampleDirect(const Interaction& interaction, LightSample&
         }
     }
 
-    Intersection shadow_intersection = scene.intersect(shadow_ray);
+    double light_distance = glm::distance(shadow_ray.start, light_pos);
 
-    if (!shadow_intersection || shadow_intersection.surface != ls.light)
+    if (scene.occluded(shadow_ray, light_distance, ls.light))
     {
         return glm::dvec3(0.0);
-    }    
+    }
 
-    double light_pdf = pow2(shadow_intersection.t) / (ls.light->area() * cos_light_theta);
+    double light_pdf = pow2(light_distance) / (ls.light->area() * cos_light_theta);
 
     double bsdf_pdf;
     glm::dvec3 bsdf_absIdotN;
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <memory>
+
 #include <nlohmann/json.hpp>
 
 #include "../scene/scene.hpp"
+#include "../camera/image.hpp"
 
 class Integrator
 {
@@ -11,13 +14,24 @@ public:
 
     virtual ~Integrator() { }
 
+    // Photon mapper if photon_map is set, path tracer otherwise, unless the scene file selects 
+    // another integrator with "integrator". The integrator, including its scene and photon 
+    // maps, can be shared by all cameras of the scene.
+    static std::shared_ptr<Integrator> create(const nlohmann::json &j, bool photon_map);
+
     struct LightSample
     {
         double bsdf_pdf = 0.0, select_probability = 0.0;
-        std::shared_ptr<Surface::Base> light;
+        const Surface::Base* light = nullptr;
     };
 
     virtual glm::dvec3 sampleRay(Ray ray) = 0;
+
+    // Saves the developed image of the camera, which not all integrators render as radiance
+    virtual void saveImage(const Image& image, const std::string& savename) const
+    {
+        image.save(savename);
+    }
     glm::dvec3 sampleDirect(const Interaction& interaction, LightSample& ls) const;
     glm::dvec3 sampleEmissive(const Interaction& interaction, const LightSample& ls) const;
     bool absorb(const Ray& ray, glm::dvec3& throughput) const;
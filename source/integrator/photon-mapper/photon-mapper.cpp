@@ -94,7 +94,7 @@ PhotonMapper::PhotonMapper(const nlohmann::json& j) : Integrator(j)
                 EmissionWork work;
                 while (work_queue.getWork(work))
                 {
-                    auto light = scene.emissives[work.light_index];
+                    const auto &light = scene.emissives[work.light_index];
                     Sampler::initiate(static_cast<uint32_t>(work.light_index));
                     for (size_t i = 0; i < work.num_emissions; i++)
                     {
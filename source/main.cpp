@@ -3,12 +3,98 @@
 #include <fstream>
 
 #include "camera/camera.hpp"
+#include "camera/partial-film.hpp"
+#include "camera/tile-server.hpp"
+#include "daemon/render-daemon.hpp"
+#include "cli/render-command.hpp"
 
 #include "common/option.hpp"
 #include "common/util.hpp"
 
 int main(int argc, char* argv[])
 {
+    // monte-carlo-ray-tracer --merge <savename> <partial films...>
+    if (argc > 1 && std::string(argv[1]) == "--merge")
+    {
+        if (argc < 4)
+        {
+            std::cout << "Usage: " << argv[0] << " --merge <savename> <partial films...>" << std::endl;
+            return -1;
+        }
+        try
+        {
+            PartialFilm::merge(std::vector<std::filesystem::path>(argv + 3, argv + argc), argv[2]);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // monte-carlo-ray-tracer --worker <address> [scenes directory]
+    if (argc > 2 && std::string(argv[1]) == "--worker")
+    {
+        if (argc > 3)
+        {
+            Scene::path = std::filesystem::current_path() / argv[3];
+        }
+        try
+        {
+            TileServer::worker(argv[2]);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // monte-carlo-ray-tracer --daemon <address> [cache budget in MB] [scenes directory] [output directory]
+    if (argc > 2 && std::string(argv[1]) == "--daemon")
+    {
+        if (argc > 4)
+        {
+            Scene::path = std::filesystem::current_path() / argv[4];
+        }
+        try
+        {
+            size_t cache_budget = argc > 3 ? std::stoull(argv[3]) : 4096;
+            std::filesystem::path output_path = std::filesystem::current_path() / (argc > 5 ? argv[5] : "");
+            RenderDaemon daemon(argv[2], cache_budget << 20, output_path);
+            daemon.run();
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // monte-carlo-ray-tracer --submit <address> <render request>
+    if (argc > 3 && std::string(argv[1]) == "--submit")
+    {
+        try
+        {
+            std::cout << RenderDaemon::submit(argv[2], nlohmann::json::parse(argv[3])).dump(2) << std::endl;
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // monte-carlo-ray-tracer --render <scene file> [options]
+    if (argc > 1 && std::string(argv[1]) == "--render")
+    {
+        return RenderCommand::run(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
     if (argc > 1)
     {
         std::string command_path;
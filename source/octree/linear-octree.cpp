@@ -6,6 +6,7 @@
 
 #include "../common/constexpr-math.hpp"
 #include "../common/util.hpp"
+#include "../common/perf-counters.hpp"
 
 template <class Data>
 LinearOctree<Data>::LinearOctree(Octree<Data> &octree_root)
@@ -43,6 +44,9 @@ void LinearOctree<Data>::knnSearch(const glm::dvec3& p, size_t k, PriorityQueue<
 
     thread_local PriorityQueue<DNode> to_visit; to_visit.clear();
 
+    PerfCounters::add(&PerfCounters::knn_queries);
+    uint64_t visited = 0;
+
     DNode current{ linear_tree[ROOT_IDX].BB.distance2(p), ROOT_IDX };
 
     while (true)
@@ -51,6 +55,7 @@ void LinearOctree<Data>::knnSearch(const glm::dvec3& p, size_t k, PriorityQueue<
         if (node.leaf || node.contained_data <= k)
         {
             uint64_t end_idx = node.start_data + node.contained_data;
+            visited += node.contained_data;
             for (uint64_t i = node.start_data; i < end_idx; i++)
             {
                 const auto& data = ordered_data[i];
@@ -114,6 +119,8 @@ void LinearOctree<Data>::knnSearch(const glm::dvec3& p, size_t k, PriorityQueue<
             to_visit.pop();
         }
     }
+
+    PerfCounters::add(&PerfCounters::photons_visited, visited);
 }
 
 template <class Data>
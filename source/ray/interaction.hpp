@@ -30,8 +30,9 @@ struct Interaction
     
     // n1 and n2 are correctly ordered.
     double t, n1, n2, T, R;
-    std::shared_ptr<Material> material;
-    std::shared_ptr<Surface::Base> surface;
+    // Non-owning, the surfaces and materials are owned by the scene
+    const Material* material;
+    const Surface::Base* surface;
     glm::dvec3 position, normal, out;
     CoordinateSystem shading_cs;
     bool inside, dirac_delta;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <cstdint>
 
 #include <glm/vec2.hpp>
 
@@ -10,7 +11,8 @@ struct Intersection
 {
     Intersection() { }
     Intersection(double t) : t(t) { }
-    std::shared_ptr<Surface::Base> surface;
+    const Surface::Base* surface = nullptr;
+    uint32_t primitive = 0; // index of intersected primitive in surface
     double t = (std::numeric_limits<double>::max)();
 
     glm::dvec2 uv;
@@ -18,6 +20,6 @@ struct Intersection
 
     explicit operator bool() const
     {
-        return surface.operator bool();
+        return surface != nullptr;
     }
 };
\ No newline at end of file
@@ -28,10 +28,17 @@ struct Sampler
         return res;
     }
 
-    // Called with e.g. linear pixel index before sampling pixel
-    static void initiate(uint32_t start_seed)
+    // Random seed of the process, used by renders that don't specify their own seed
+    static uint32_t globalSeed()
     {
-        base_seed = hashCombine(global_seed, hash(start_seed));
+        return global_seed;
+    }
+
+    // Called with e.g. linear pixel index before sampling pixel. The render seed 
+    // selects the sequences of the render, e.g. to continue a render checkpoint.
+    static void initiate(uint32_t start_seed, uint32_t render_seed = global_seed)
+    {
+        base_seed = hashCombine(render_seed, hash(start_seed));
     }
 
     // Called with e.g. ray path index before each pixel sample
@@ -10,10 +10,18 @@
 #include "../surface/surface.hpp"
 #include "../bvh/bvh.hpp"
 #include "../sampling/sampling.hpp"
+#include "../common/bundle.hpp"
+#include "../common/mapped-file.hpp"
+#include "../common/perf-counters.hpp"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
+#include <set>
+#include <thread>
+#include <charconv>
+#include <cstring>
 
 Scene::Scene(const nlohmann::json& j)
 {
@@ -21,6 +29,99 @@ Scene::Scene(const nlohmann::json& j)
     auto vertices = getOptional(j, "vertices", std::unordered_map<std::string, std::vector<glm::dvec3>>());
     ior = getOptional(j, "ior", 1.0);
 
+    /**************************************************************************
+     OBJ files that are referenced by several non-emissive objects are loaded
+     once into an object space mesh with its own BVH, and each object becomes
+     an instance of that mesh. This requires a scene BVH to traverse the 
+     bottom-level BVHs from, and objects that are only used once are still 
+     transformed into world space since that gives a better tree.
+    ***************************************************************************/
+    struct InstancedMesh
+    {
+        std::shared_ptr<Surface::Mesh> mesh;
+        std::shared_ptr<BVH> bvh;
+    };
+    std::unordered_map<std::string, size_t> object_uses;
+    std::unordered_map<std::string, InstancedMesh> instanced_meshes;
+
+    auto objectKey = [](const nlohmann::json &s)
+    {
+        return s.at("file").get<std::string>() + (getOptional(s, "smooth", false) ? ":smooth" : "");
+    };
+
+    if (j.find("bvh") != j.end())
+    {
+        for (const auto& s : j.at("surfaces"))
+        {
+            if (s.at("type") == "object" && s.find("file") != s.end() &&
+                glm::compMax(materials.at(getOptional<std::string>(s, "material", "default"))->emittance) <= C::EPSILON)
+            {
+                object_uses[objectKey(s)]++;
+            }
+        }
+    }
+
+    size_t num_instanced_primitives = 0;
+
+    /**************************************************************************
+     The meshes and BVHs are optionally cached in a scene bundle, which is 
+     named by a hash of the parts of the scene that the geometry depends on 
+     and all OBJ files it references, so camera edits reuse the bundle. If 
+     there is a bundle for the current scene, the meshes and BVHs are read 
+     from it in the same order as they are created below instead of being 
+     built. Reading a bundle marks it as recently used, and only the most 
+     recently used bundles are kept when a new one is written.
+    ***************************************************************************/
+    bool use_bundle = getOptional(j, "bundle", false);
+    constexpr size_t max_bundles = 8;
+    std::unique_ptr<Bundle::Reader> bundle;
+    std::filesystem::path bundle_path;
+    uint64_t bundle_key = 0;
+    std::vector<InstancedMesh> bundle_objects; // created meshes in order, mesh is null if empty
+
+    if (use_bundle)
+    {
+        nlohmann::json geometry;
+        for (const auto& key : { "surfaces", "materials", "vertices", "bvh" })
+        {
+            if (j.find(key) != j.end()) geometry[key] = j.at(key);
+        }
+        std::string scene_string = geometry.dump();
+        bundle_key = Bundle::hash(scene_string.data(), scene_string.size());
+
+        std::set<std::string> files;
+        for (const auto& s : j.at("surfaces"))
+        {
+            if (s.find("file") != s.end() && files.insert(s.at("file").get<std::string>()).second)
+            {
+                auto file_path = path / s.at("file").get<std::string>();
+                if (std::filesystem::exists(file_path))
+                {
+                    MappedFile file(file_path);
+                    bundle_key = Bundle::hash(file.data(), file.size(), bundle_key);
+                }
+            }
+        }
+
+        std::stringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << bundle_key << ".bundle";
+        bundle_path = path / "bundles" / name.str();
+
+        if (std::filesystem::exists(bundle_path))
+        {
+            try
+            {
+                bundle = std::make_unique<Bundle::Reader>(bundle_path, bundle_key);
+                std::filesystem::last_write_time(bundle_path, std::filesystem::file_time_type::clock::now());
+                std::cout << "\nLoading meshes and BVH from scene bundle " << name.str() << std::endl;
+            }
+            catch (const std::exception& ex)
+            {
+                std::cout << "\n" << ex.what() << " The scene bundle will be rebuilt." << std::endl;
+            }
+        }
+    }
+
     for (const auto& s : j.at("surfaces"))
     {
         std::string material_str = "default";
@@ -43,34 +144,100 @@ Scene::Scene(const nlohmann::json& j)
         std::string type = s.at("type");
         if (type == "object")
         {
+            bool smooth = getOptional(s, "smooth", false);
+            bool is_emissive = glm::compMax(material->emittance) > C::EPSILON;
+
             std::vector<glm::dvec3> v, n;
-            std::vector<std::vector<size_t>> triangles_v, triangles_vt, triangles_vn;
-            if (s.find("file") != s.end())
+            std::vector<glm::uvec3> triangles_v, triangles_vn;
+            auto loadObject = [&]()
             {
-                auto obj_path = path / s.at("file").get<std::string>();
-                parseOBJ(obj_path, v, n, triangles_v, triangles_vt, triangles_vn);
-            }
-            else
-            {
-                v = vertices.at(s.at("vertex_set"));
-                triangles_v = s.at("triangles").get<std::vector<std::vector<size_t>>>();
-            }
+                if (s.find("file") != s.end())
+                {
+                    auto obj_path = path / s.at("file").get<std::string>();
+                    parseOBJ(obj_path, v, n, triangles_v, triangles_vn);
+                }
+                else
+                {
+                    v = vertices.at(s.at("vertex_set"));
+                    for (const auto& t : s.at("triangles"))
+                    {
+                        triangles_v.emplace_back(t.at(0).get<uint32_t>(), t.at(1).get<uint32_t>(), t.at(2).get<uint32_t>());
+                    }
+                }
 
-            bool smooth = getOptional(s, "smooth", false);
+                if (smooth && triangles_vn.empty())
+                {
+                    n.clear();
+                    generateVertexNormals(n, v, triangles_v);
+                    triangles_vn = triangles_v;
+                }
+                if (!smooth) triangles_vn.clear();
+            };
 
-            if (smooth && n.empty())
+            // Emissive objects are split into separate triangles below, since each triangle needs its own material
+            if (!is_emissive)
             {
-                generateVertexNormals(n, v, triangles_v);
-                triangles_vn = triangles_v;
+                bool instanced = s.find("file") != s.end() && object_uses[objectKey(s)] > 1;
+
+                InstancedMesh object = instanced ? instanced_meshes[objectKey(s)] : InstancedMesh();
+                if (!object.mesh)
+                {
+                    // Bundled meshes are already transformed
+                    if (bundle)
+                    {
+                        if (bundle->read<uint8_t>())
+                        {
+                            object.mesh = std::make_shared<Surface::Mesh>(*bundle, material);
+                            if (instanced)
+                            {
+                                object.bvh = std::make_shared<BVH>(*bundle, std::vector<std::shared_ptr<Surface::Base>>{ object.mesh }, 1);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        loadObject();
+                        if (!triangles_v.empty())
+                        {
+                            object.mesh = std::make_shared<Surface::Mesh>(v, n, triangles_v, triangles_vn, material);
+                            if (instanced)
+                            {
+                                std::vector<std::shared_ptr<Surface::Base>> mesh_surfaces{ object.mesh };
+                                object.bvh = std::make_shared<BVH>(object.mesh->BB(), mesh_surfaces, j.at("bvh"), 1);
+                            }
+                            else if (transform)
+                            {
+                                object.mesh->transform(*transform);
+                            }
+                        }
+                    }
+                    bundle_objects.push_back(object);
+
+                    if (!object.mesh) continue;
+                    if (instanced) instanced_meshes[objectKey(s)] = object;
+                }
+
+                if (instanced)
+                {
+                    num_instanced_primitives += object.mesh->numPrimitives();
+                    surfaces.push_back(std::make_shared<Surface::Instance>(object.mesh, object.bvh, material));
+                    if (transform) surfaces.back()->transform(*transform);
+                }
+                else
+                {
+                    surfaces.push_back(object.mesh);
+                }
+                continue;
             }
 
-            bool is_emissive = glm::compMax(material->emittance) > C::EPSILON;
+            loadObject();
+
             double total_area = 0.0;
             if (is_emissive)
             {
                 for (const auto& t : triangles_v)
                 {
-                    total_area += Surface::Triangle(v.at(t.at(0)), v.at(t.at(1)), v.at(t.at(2)), nullptr).area();
+                    total_area += Surface::Triangle(v.at(t[0]), v.at(t[1]), v.at(t[2]), nullptr).area();
                 }
             }
 
@@ -83,7 +250,7 @@ Scene::Scene(const nlohmann::json& j)
                 std::shared_ptr<Material> mat;
                 if (is_emissive && total_area > C::EPSILON)
                 {
-                    double area = Surface::Triangle(v.at(t.at(0)), v.at(t.at(1)), v.at(t.at(2)), nullptr).area();
+                    double area = Surface::Triangle(v.at(t[0]), v.at(t[1]), v.at(t[2]), nullptr).area();
                     mat = std::make_shared<Material>(*material);
                     mat->emittance *= area / total_area;
                 }
@@ -96,14 +263,14 @@ Scene::Scene(const nlohmann::json& j)
                 {
                     const auto &tn = triangles_vn[i];
                     surfaces.push_back(std::make_shared<Surface::Triangle>(
-                        v.at(t.at(0)), v.at(t.at(1)), v.at(t.at(2)),
-                        n.at(tn.at(0)), n.at(tn.at(1)), n.at(tn.at(2)), mat)
+                        v.at(t[0]), v.at(t[1]), v.at(t[2]),
+                        n.at(tn[0]), n.at(tn[1]), n.at(tn[2]), mat)
                     );
                 }
                 else
                 {
                     surfaces.push_back(std::make_shared<Surface::Triangle>(
-                        v.at(t.at(0)), v.at(t.at(1)), v.at(t.at(2)), mat)
+                        v.at(t[0]), v.at(t[1]), v.at(t[2]), mat)
                     );
                 }
                 if (transform) surfaces.back()->transform(*transform);
@@ -138,11 +305,63 @@ Scene::Scene(const nlohmann::json& j)
 
     computeBoundingBox();
 
-    std::cout << "\nNumber of primitives: " << Format::largeNumber(surfaces.size()) << std::endl;
+    size_t num_primitives = 0;
+    for (const auto& surface : surfaces)
+    {
+        num_primitives += surface->numPrimitives();
+    }
+
+    std::cout << "\nNumber of primitives: " << Format::largeNumber(num_primitives) << std::endl;
+
+    if (!instanced_meshes.empty())
+    {
+        std::cout << "Number of instanced primitives: " << Format::largeNumber(num_instanced_primitives)
+                  << " in " << instanced_meshes.size() << " meshes" << std::endl;
+    }
 
     if (j.find("bvh") != j.end())
     {
-        bvh = std::make_shared<BVH>(BB_, surfaces, j.at("bvh"));
+        if (bundle)
+        {
+            bvh = std::make_shared<BVH>(*bundle, surfaces);
+        }
+        else
+        {
+            bvh = std::make_shared<BVH>(BB_, surfaces, j.at("bvh"));
+        }
+    }
+
+    // Written after the BVH is built since it reorders the mesh triangles
+    if (use_bundle && !bundle)
+    {
+        try
+        {
+            Bundle::Writer writer(bundle_path, bundle_key);
+            for (const auto& object : bundle_objects)
+            {
+                writer.write<uint8_t>(object.mesh != nullptr);
+                if (object.mesh)
+                {
+                    object.mesh->write(writer);
+                    if (object.bvh)
+                    {
+                        object.bvh->write(writer, { object.mesh });
+                    }
+                }
+            }
+            if (bvh)
+            {
+                bvh->write(writer, surfaces);
+            }
+            writer.finish();
+            std::cout << "Scene bundle written to " << bundle_path.string() << std::endl;
+
+            Bundle::prune(bundle_path.parent_path(), max_bundles);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << ex.what() << std::endl;
+        }
     }
 
     generateEmissives();
@@ -152,6 +371,8 @@ Intersection Scene::intersect(const Ray& ray) const
 {
     Intersection intersection;
 
+    PerfCounters::addRay(ray.depth);
+
     if (bvh)
     {
         intersection = bvh->intersect(ray);
@@ -160,13 +381,16 @@ Intersection Scene::intersect(const Ray& ray) const
     {
         for (const auto& s : surfaces)
         {
-            Intersection t_intersection;
-            if (s->intersect(ray, t_intersection))
+            for (uint32_t i = 0; i < s->numPrimitives(); i++)
             {
-                if (t_intersection.t < intersection.t)
+                Intersection t_intersection;
+                if (s->intersect(ray, i, t_intersection))
                 {
-                    intersection = t_intersection;
-                    intersection.surface = s;
+                    if (t_intersection.t < intersection.t)
+                    {
+                        intersection = t_intersection;
+                        intersection.surface = s.get();
+                    }
                 }
             }
         }
@@ -175,6 +399,42 @@ Intersection Scene::intersect(const Ray& ray) const
     return intersection;
 }
 
+bool Scene::occluded(const Ray& ray, double t_max, const Surface::Base* ignore) const
+{
+    PerfCounters::add(&PerfCounters::shadow_rays);
+
+    bool occluded = occludedSurfaces(ray, t_max, ignore);
+    if (occluded)
+    {
+        PerfCounters::add(&PerfCounters::occluded_shadow_rays);
+    }
+    return occluded;
+}
+
+bool Scene::occludedSurfaces(const Ray& ray, double t_max, const Surface::Base* ignore) const
+{
+    if (bvh)
+    {
+        return bvh->occluded(ray, t_max, ignore);
+    }
+
+    for (const auto& s : surfaces)
+    {
+        if (s.get() == ignore)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < s->numPrimitives(); i++)
+        {
+            if (s->occludes(ray, i, t_max))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void Scene::generateEmissives()
 {
     for (const auto& surface : surfaces)
@@ -222,7 +482,7 @@ glm::dvec3 Scene::skyColor(const Ray& ray) const
     return glm::mix(glm::dvec3(1.0, 0.5, 0.0), glm::dvec3(0.0, 0.5, 1.0), fy);
 }
 
-std::shared_ptr<Surface::Base> Scene::selectLight(double u, double& select_probability) const
+const Surface::Base* Scene::selectLight(double u, double& select_probability) const
 {
     size_t emissive_idx = Sampling::weightedIdx(u, cumulative_emissives_importance);
 
@@ -232,15 +492,59 @@ std::shared_ptr<Surface::Base> Scene::selectLight(double u, double& select_proba
         select_probability -= cumulative_emissives_importance[emissive_idx - 1];
     }
 
-    return emissives[emissive_idx];
+    return emissives[emissive_idx].get();
+}
+
+static const char* skipSpace(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static bool isSpace(const char* p, const char* end)
+{
+    return p == end || *p == ' ' || *p == '\t' || *p == '\r';
+}
+
+static const char* parseDouble(const char* p, const char* end, double &value)
+{
+    p = skipSpace(p, end);
+    if (p < end && *p == '+') p++;
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc())
+    {
+        throw std::runtime_error("Invalid number in OBJ file.");
+    }
+    return ptr;
+}
+
+// OBJ indices start at 1, and negative indices are relative to the last defined element
+static uint32_t resolveIndex(const char* &p, const char* end, size_t count)
+{
+    int64_t index;
+    auto [ptr, ec] = std::from_chars(p, end, index);
+    int64_t resolved = index > 0 ? index - 1 : (int64_t)count + index;
+    if (ec != std::errc() || index == 0 || resolved < 0 || resolved > UINT32_MAX)
+    {
+        throw std::runtime_error("Invalid index in OBJ file.");
+    }
+    p = ptr;
+    return (uint32_t)resolved;
 }
 
+/**************************************************************************
+ Parses the OBJ file in parallel chunks of lines. The first pass counts the
+ vertices, normals and triangles of each chunk, which gives each chunk its 
+ offsets in the output arrays. The second pass then parses each chunk with 
+ std::from_chars straight into the output arrays. The offsets also resolve
+ negative indices, and faces with more than three vertices are split into 
+ triangle fans. Texture coordinates are not used and are skipped.
+***************************************************************************/
 void Scene::parseOBJ(const std::filesystem::path &path,
                      std::vector<glm::dvec3> &vertices,
                      std::vector<glm::dvec3> &normals,
-                     std::vector<std::vector<size_t>> &triangles_v,
-                     std::vector<std::vector<size_t>> &triangles_vt,
-                     std::vector<std::vector<size_t>> &triangles_vn) const
+                     std::vector<glm::uvec3> &triangles_v,
+                     std::vector<glm::uvec3> &triangles_vn) const
 {
     if (!std::filesystem::exists(path))
     {
@@ -248,83 +552,219 @@ void Scene::parseOBJ(const std::filesystem::path &path,
         return;
     }
 
-    std::ifstream file(path);
+    MappedFile file(path);
+    if (file.size() == 0)
+    {
+        return;
+    }
 
-    auto isNumber = [](const std::string &s) 
+    struct Chunk
     {
-        return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+        const char* begin;
+        const char* end;
+        size_t vertices = 0, normals = 0, triangles = 0; // counts, then offsets
+        bool missing_normals = false;
+        std::exception_ptr error = nullptr;
     };
 
-    std::string line;
-    while (std::getline(file, line))
+    // Chunks end at line breaks, small files are parsed by a single thread
+    constexpr size_t min_chunk_size = 1 << 20;
+    size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t num_chunks = std::clamp<size_t>(file.size() / min_chunk_size, 1, num_threads);
+
+    const char* file_end = file.data() + file.size();
+    std::vector<Chunk> chunks;
+    const char* chunk_begin = file.data();
+    for (size_t i = 1; i <= num_chunks && chunk_begin < file_end; i++)
     {
-        std::stringstream ss(line);
-        std::string line_type;
-        ss >> line_type;
+        const char* chunk_end = std::max(file.data() + i * file.size() / num_chunks, chunk_begin);
+        chunk_end = std::find(chunk_end, file_end, '\n');
+        if (chunk_end != file_end) chunk_end++;
+        chunks.push_back({ chunk_begin, chunk_end });
+        chunk_begin = chunk_end;
+    }
 
-        if (line_type == "v")
+    auto forEachChunk = [&chunks](auto f)
+    {
+        std::vector<std::unique_ptr<std::thread>> workers;
+        for (auto &chunk : chunks)
         {
-            glm::dvec3 v;
-            ss >> v.x >> v.y >> v.z;
-
-            vertices.push_back(v);
+            workers.push_back(std::make_unique<std::thread>([&f, &chunk]()
+            {
+                try
+                {
+                    f(chunk);
+                }
+                catch (...)
+                {
+                    chunk.error = std::current_exception();
+                }
+            }));
+        }
+        for (auto &worker : workers)
+        {
+            worker->join();
         }
-        if (line_type == "vn")
+        for (const auto &chunk : chunks)
         {
-            glm::dvec3 vn;
-            ss >> vn.x >> vn.y >> vn.z;
+            if (chunk.error) std::rethrow_exception(chunk.error);
+        }
+    };
+
+    enum LineType { VERTEX, NORMAL, FACE, OTHER };
 
-            normals.push_back(vn);
+    // Finds the type of the line and moves p past the keyword
+    auto lineType = [](const char* &p, const char* end)
+    {
+        p = skipSpace(p, end);
+        if (end - p >= 2 && p[0] == 'v' && isSpace(p + 1, end)) { p += 1; return VERTEX; }
+        if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p + 2, end)) { p += 2; return NORMAL; }
+        if (end - p >= 2 && p[0] == 'f' && isSpace(p + 1, end)) { p += 1; return FACE; }
+        return OTHER;
+    };
+
+    auto forEachLine = [](const Chunk &chunk, auto f)
+    {
+        const char* p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char* line_end = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+            if (!line_end) line_end = chunk.end;
+            f(p, line_end);
+            p = line_end + 1;
         }
-        else if (line_type == "f")
+    };
+
+    // Face elements are separated by whitespace, the rest of the line is a comment after #
+    auto nextElement = [](const char* p, const char* end)
+    {
+        p = skipSpace(p, end);
+        return (p < end && *p != '#') ? p : end;
+    };
+
+    forEachChunk([&](Chunk &chunk)
+    {
+        forEachLine(chunk, [&](const char* p, const char* end)
         {
-            std::vector<size_t> triangle_v, triangle_vt, triangle_vn;
-            for (int i = 0; i < 3; i++)
+            switch (lineType(p, end))
             {
-                std::string element;
-                ss >> element;
-                std::stringstream ss_f(element);
-
-                std::vector<size_t> idxs;
-                while (ss_f.good())
+                case VERTEX: chunk.vertices++; break;
+                case NORMAL: chunk.normals++; break;
+                case FACE:
                 {
-                    if (ss_f.peek() == '-')
+                    size_t num_elements = 0;
+                    for (p = nextElement(p, end); p < end; p = nextElement(p, end))
                     {
-                        throw std::runtime_error("OBJ files with negative offsets are not supported.");
+                        while (!isSpace(p, end)) p++;
+                        num_elements++;
                     }
-                    std::string idx;
-                    std::getline(ss_f, idx, '/');
-                    idxs.push_back(isNumber(idx) ? std::stoull(idx) : 0);
+                    if (num_elements >= 3) chunk.triangles += num_elements - 2;
+                    break;
                 }
+                default: break;
+            }
+        });
+    });
+
+    size_t offset_v = vertices.size(), offset_vn = normals.size(), offset_t = triangles_v.size();
+    for (auto &chunk : chunks)
+    {
+        std::swap(offset_v, chunk.vertices);
+        std::swap(offset_vn, chunk.normals);
+        std::swap(offset_t, chunk.triangles);
+        offset_v += chunk.vertices;
+        offset_vn += chunk.normals;
+        offset_t += chunk.triangles;
+    }
+    vertices.resize(offset_v);
+    normals.resize(offset_vn);
+    triangles_v.resize(offset_t);
+    triangles_vn.resize(offset_t);
 
-                if (idxs.size() == 1)
+    forEachChunk([&](Chunk &chunk)
+    {
+        forEachLine(chunk, [&](const char* p, const char* end)
+        {
+            switch (lineType(p, end))
+            {
+                case VERTEX:
                 {
-                    triangle_v.push_back(idxs[0] - 1);
+                    auto &v = vertices[chunk.vertices++];
+                    p = parseDouble(p, end, v.x);
+                    p = parseDouble(p, end, v.y);
+                    parseDouble(p, end, v.z);
+                    break;
                 }
-                else if (idxs.size() == 2)
+                case NORMAL:
                 {
-                    triangle_v.push_back(idxs[0] - 1);
-                    triangle_vt.push_back(idxs[1] - 1);
+                    auto &vn = normals[chunk.normals++];
+                    p = parseDouble(p, end, vn.x);
+                    p = parseDouble(p, end, vn.y);
+                    parseDouble(p, end, vn.z);
+                    break;
                 }
-                else if (idxs.size() == 3)
+                case FACE:
                 {
-                    triangle_v.push_back(idxs[0] - 1);
-                    if (idxs[1]) triangle_vt.push_back(idxs[1] - 1);
-                    triangle_vn.push_back(idxs[2] - 1);
+                    // Element formats: v, v/vt, v//vn or v/vt/vn
+                    glm::uvec2 first, previous;
+                    size_t num_elements = 0;
+                    bool has_normals = true;
+                    for (p = nextElement(p, end); p < end; p = nextElement(p, end))
+                    {
+                        glm::uvec2 element(resolveIndex(p, end, chunk.vertices), 0);
+
+                        bool has_normal = false;
+                        if (p < end && *p == '/')
+                        {
+                            p++;
+                            while (!isSpace(p, end) && *p != '/') p++;
+                            if (p < end && *p == '/')
+                            {
+                                p++;
+                                element.y = resolveIndex(p, end, chunk.normals);
+                                has_normal = true;
+                            }
+                        }
+                        if (!isSpace(p, end))
+                        {
+                            throw std::runtime_error("Invalid face element in OBJ file.");
+                        }
+                        has_normals = has_normals && has_normal;
+
+                        if (num_elements == 0)
+                        {
+                            first = element;
+                        }
+                        else if (num_elements >= 2)
+                        {
+                            size_t t = chunk.triangles++;
+                            triangles_v[t] = { first.x, previous.x, element.x };
+                            triangles_vn[t] = { first.y, previous.y, element.y };
+                        }
+                        previous = element;
+                        num_elements++;
+                    }
+                    if (num_elements >= 3 && !has_normals)
+                    {
+                        chunk.missing_normals = true;
+                    }
+                    break;
                 }
+                default: break;
             }
-            if (triangle_v.size() == 3) triangles_v.push_back(triangle_v);
-            if (triangle_vt.size() == 3) triangles_vt.push_back(triangle_vt);
-            if (triangle_vn.size() == 3) triangles_vn.push_back(triangle_vn);
-        }
-    }
+        });
+    });
 
-    file.close();
+    // Normal indices are only used if all faces have them
+    if (normals.empty() || std::any_of(chunks.begin(), chunks.end(), [](const auto &c) { return c.missing_normals; }))
+    {
+        triangles_vn.clear();
+    }
 }
 
 void Scene::generateVertexNormals(std::vector<glm::dvec3> &normals,
                                   const std::vector<glm::dvec3> &vertices,
-                                  const std::vector<std::vector<size_t>> &triangles) const
+                                  const std::vector<glm::uvec3> &triangles) const
 {
     normals.resize(vertices.size(), glm::dvec3(0.0));
 
@@ -335,17 +775,17 @@ void Scene::generateVertexNormals(std::vector<glm::dvec3> &normals,
 
     for (const auto &t : triangles)
     {
-        const auto &v0 = vertices.at(t.at(0));
-        const auto &v1 = vertices.at(t.at(1));
-        const auto &v2 = vertices.at(t.at(2));
+        const auto &v0 = vertices.at(t[0]);
+        const auto &v1 = vertices.at(t[1]);
+        const auto &v2 = vertices.at(t[2]);
 
         auto triangle = Surface::Triangle(v0, v1, v2, nullptr);
 
         glm::dvec3 area_weighted_normal = triangle.normal() * triangle.area();
 
-        normals.at(t.at(0)) += area_weighted_normal * angleBetween(v0 - v1, v0 - v2);
-        normals.at(t.at(1)) += area_weighted_normal * angleBetween(v1 - v0, v1 - v2);
-        normals.at(t.at(2)) += area_weighted_normal * angleBetween(v2 - v0, v2 - v1);
+        normals.at(t[0]) += area_weighted_normal * angleBetween(v0 - v1, v0 - v2);
+        normals.at(t[1]) += area_weighted_normal * angleBetween(v1 - v0, v1 - v2);
+        normals.at(t[2]) += area_weighted_normal * angleBetween(v2 - v0, v2 - v1);
     }
 
     for (auto &n : normals)
@@ -20,6 +20,9 @@ public:
 
     Intersection intersect(const Ray& ray) const;
 
+    // True if any surface except ignore intersects the ray before t_max
+    bool occluded(const Ray& ray, double t_max, const Surface::Base* ignore = nullptr) const;
+
     void generateEmissives();
 
     glm::dvec3 skyColor(const Ray& ray) const;
@@ -28,7 +31,7 @@ public:
     std::vector<std::shared_ptr<Surface::Base>> emissives; // subset of surfaces
     std::vector<double> cumulative_emissives_importance;
 
-    std::shared_ptr<Surface::Base> selectLight(double u, double& select_probability) const;
+    const Surface::Base* selectLight(double u, double& select_probability) const;
 
     BoundingBox BB() const
     {
@@ -46,14 +49,15 @@ private:
 
     void computeBoundingBox();
 
+    bool occludedSurfaces(const Ray& ray, double t_max, const Surface::Base* ignore) const;
+
     void parseOBJ(const std::filesystem::path &path,
                   std::vector<glm::dvec3> &vertices,
                   std::vector<glm::dvec3> &normals,
-                  std::vector<std::vector<size_t>> &triangles_v,
-                  std::vector<std::vector<size_t>> &triangles_vt,
-                  std::vector<std::vector<size_t>> &triangles_vn) const;
+                  std::vector<glm::uvec3> &triangles_v,
+                  std::vector<glm::uvec3> &triangles_vn) const;
 
     void generateVertexNormals(std::vector<glm::dvec3> &normals,
                                const std::vector<glm::dvec3> &vertices, 
-                               const std::vector<std::vector<size_t>> &triangles) const;
+                               const std::vector<glm::uvec3> &triangles) const;
 };
\ No newline at end of file
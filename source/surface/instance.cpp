@@ -0,0 +1,77 @@
+#include "surface.hpp"
+
+#include "../bvh/bvh.hpp"
+
+Surface::Instance::Instance(std::shared_ptr<Mesh> mesh, std::shared_ptr<BVH> bvh, std::shared_ptr<Material> material)
+    : Base(material), mesh(mesh), bvh(bvh), to_world(1.0), to_object(1.0), normal_matrix(1.0)
+{
+    computeArea();
+    computeBoundingBox();
+}
+
+// The direction is not normalized, which keeps the ray parameter t the same in both spaces
+Ray Surface::Instance::toObject(const Ray& ray) const
+{
+    Ray object_ray = ray;
+    object_ray.start = to_object * glm::dvec4(ray.start, 1.0);
+    object_ray.direction = glm::dmat3(to_object) * ray.direction;
+    object_ray.inv_direction = 1.0 / object_ray.direction;
+    return object_ray;
+}
+
+bool Surface::Instance::intersect(const Ray& ray, uint32_t /*primitive*/, Intersection& intersection) const
+{
+    intersection = bvh->intersect(toObject(ray));
+    return (bool)intersection;
+}
+
+bool Surface::Instance::occludes(const Ray& ray, uint32_t /*primitive*/, double t_max) const
+{
+    return bvh->occluded(toObject(ray), t_max);
+}
+
+void Surface::Instance::transform(const Transform &T)
+{
+    to_world = T.matrix * to_world;
+    to_object = glm::inverse(to_world);
+    normal_matrix = glm::transpose(glm::dmat3(to_object));
+
+    computeBoundingBox();
+}
+
+// Instances are never emissive and are therefore never sampled
+glm::dvec3 Surface::Instance::operator()(double /*u*/, double /*v*/) const
+{
+    return glm::dvec3();
+}
+
+// Instances are never emissive and are therefore never sampled
+glm::dvec3 Surface::Instance::normal(const glm::dvec3& /*pos*/) const
+{
+    return glm::dvec3();
+}
+
+glm::dvec3 Surface::Instance::normal(const Intersection& intersection, const glm::dvec3& pos) const
+{
+    glm::dvec3 object_pos = to_object * glm::dvec4(pos, 1.0);
+    return glm::normalize(normal_matrix * mesh->normal(intersection, object_pos));
+}
+
+glm::dvec3 Surface::Instance::interpolatedNormal(const Intersection& intersection) const
+{
+    return glm::normalize(normal_matrix * mesh->interpolatedNormal(intersection));
+}
+
+void Surface::Instance::computeBoundingBox()
+{
+    BoundingBox mesh_BB = mesh->BB();
+
+    BB_ = BoundingBox();
+    for (int i = 0; i < 8; i++)
+    {
+        glm::dvec3 corner((i & 1) ? mesh_BB.max.x : mesh_BB.min.x,
+                          (i & 2) ? mesh_BB.max.y : mesh_BB.min.y,
+                          (i & 4) ? mesh_BB.max.z : mesh_BB.min.z);
+        BB_.merge(glm::dvec3(to_world * glm::dvec4(corner, 1.0)));
+    }
+}
@@ -0,0 +1,256 @@
+#include "surface.hpp"
+
+#include <glm/gtx/component_wise.hpp>
+
+#include "../common/constants.hpp"
+#include "../common/bundle.hpp"
+
+Surface::Mesh::Mesh(const std::vector<glm::dvec3> &vertices,
+                    const std::vector<glm::dvec3> &normals,
+                    const std::vector<glm::uvec3> &triangles_v,
+                    const std::vector<glm::uvec3> &triangles_vn,
+                    std::shared_ptr<Material> material)
+    : Base(material), triangles(triangles_v)
+{
+    this->vertices.reserve(vertices.size());
+    for (const auto &v : vertices)
+    {
+        this->vertices.emplace_back(v);
+    }
+
+    for (const auto &t : triangles)
+    {
+        if (glm::compMax(t) >= this->vertices.size())
+        {
+            throw std::runtime_error("Mesh vertex index out of range.");
+        }
+    }
+
+    // Faces without normals in the OBJ file makes the normal indices incomplete
+    if (!normals.empty() && triangles_vn.size() == triangles_v.size())
+    {
+        this->normals.reserve(normals.size());
+        for (const auto &n : normals)
+        {
+            this->normals.emplace_back(glm::normalize(n));
+        }
+
+        for (const auto &t : triangles_vn)
+        {
+            if (glm::compMax(t) >= this->normals.size())
+            {
+                throw std::runtime_error("Mesh normal index out of range.");
+            }
+        }
+        triangle_normals = triangles_vn;
+    }
+
+    computeArea();
+    computeBoundingBox();
+}
+
+Surface::Mesh::Mesh(Bundle::Reader &bundle, std::shared_ptr<Material> material)
+    : Base(material)
+{
+    bundle.read(vertices);
+    bundle.read(normals);
+    bundle.read(triangles);
+    bundle.read(triangle_normals);
+    area_ = bundle.read<double>();
+    BB_ = bundle.read<BoundingBox>();
+
+    for (const auto &t : triangles)
+    {
+        if (glm::compMax(t) >= vertices.size())
+        {
+            throw std::runtime_error("Mesh vertex index in scene bundle out of range.");
+        }
+    }
+
+    if (!triangle_normals.empty() && triangle_normals.size() != triangles.size())
+    {
+        throw std::runtime_error("Mesh normal indices in scene bundle don't match the triangles.");
+    }
+
+    for (const auto &t : triangle_normals)
+    {
+        if (glm::compMax(t) >= normals.size())
+        {
+            throw std::runtime_error("Mesh normal index in scene bundle out of range.");
+        }
+    }
+}
+
+void Surface::Mesh::write(Bundle::Writer &bundle) const
+{
+    bundle.write(vertices);
+    bundle.write(normals);
+    bundle.write(triangles);
+    bundle.write(triangle_normals);
+    bundle.write(area_);
+    bundle.write(BB_);
+}
+
+bool Surface::Mesh::intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const
+{
+    const auto &tri = triangles[primitive];
+    glm::dvec3 v0 = vertices[tri.x];
+
+    double t, u, v;
+    if (!mollerTrumbore(ray, v0, glm::dvec3(vertices[tri.y]) - v0, glm::dvec3(vertices[tri.z]) - v0, t, u, v))
+    {
+        return false;
+    }
+
+    intersection = Intersection(t);
+    intersection.primitive = primitive;
+
+    if (!triangle_normals.empty())
+    {
+        intersection.uv = { u, v };
+        intersection.interpolate = true;
+    }
+
+    return true;
+}
+
+bool Surface::Mesh::occludes(const Ray& ray, uint32_t primitive, double t_max) const
+{
+    const auto &tri = triangles[primitive];
+    glm::dvec3 v0 = vertices[tri.x];
+
+    double t, u, v;
+    return mollerTrumbore(ray, v0, glm::dvec3(vertices[tri.y]) - v0, glm::dvec3(vertices[tri.z]) - v0, t, u, v) && t < t_max;
+}
+
+void Surface::Mesh::transform(const Transform &T)
+{
+    for (auto &v : vertices)
+    {
+        v = T.matrix * glm::dvec4(v, 1.0);
+    }
+
+    for (auto &n : normals)
+    {
+        n = T.transformNormal(n);
+    }
+
+    if (T.negative_determinant)
+    {
+        for (auto &t : triangles) std::swap(t.y, t.z);
+        for (auto &t : triangle_normals) std::swap(t.y, t.z);
+    }
+
+    computeArea();
+    computeBoundingBox();
+}
+
+// Meshes are never emissive and are therefore never sampled
+glm::dvec3 Surface::Mesh::operator()(double /*u*/, double /*v*/) const
+{
+    return glm::dvec3();
+}
+
+// Meshes are never emissive and are therefore never sampled
+glm::dvec3 Surface::Mesh::normal(const glm::dvec3& /*pos*/) const
+{
+    return glm::dvec3();
+}
+
+glm::dvec3 Surface::Mesh::normal(const Intersection& intersection, const glm::dvec3& /*pos*/) const
+{
+    const auto &tri = triangles[intersection.primitive];
+    glm::dvec3 v0 = vertices[tri.x];
+    return glm::normalize(glm::cross(glm::dvec3(vertices[tri.y]) - v0, glm::dvec3(vertices[tri.z]) - v0));
+}
+
+glm::dvec3 Surface::Mesh::interpolatedNormal(const Intersection& intersection) const
+{
+    const auto &tri = triangle_normals[intersection.primitive];
+    const auto &uv = intersection.uv;
+    return glm::normalize((1.0 - uv.x - uv.y) * glm::dvec3(normals[tri.x]) +
+                          uv.x * glm::dvec3(normals[tri.y]) +
+                          uv.y * glm::dvec3(normals[tri.z]));
+}
+
+uint32_t Surface::Mesh::numPrimitives() const
+{
+    return (uint32_t)triangles.size();
+}
+
+BoundingBox Surface::Mesh::primitiveBB(uint32_t primitive) const
+{
+    const auto &tri = triangles[primitive];
+    BoundingBox BB;
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        BB.merge(glm::dvec3(vertices[tri[i]]));
+    }
+    return BB;
+}
+
+void Surface::Mesh::splitPrimitive(uint32_t primitive, const BoundingBox &BB, int axis, double position,
+                                   BoundingBox &left, BoundingBox &right) const
+{
+    const auto &tri = triangles[primitive];
+    splitTriangle(vertices[tri.x], vertices[tri.y], vertices[tri.z], BB, axis, position, left, right);
+}
+
+/*****************************************************************************
+ Reorders the triangles so that triangle i becomes triangle order[i]. The
+ vertices and normals are then reordered by first use, which places the
+ vertices of nearby triangles close in memory and drops unused vertices.
+******************************************************************************/
+void Surface::Mesh::reorderPrimitives(const std::vector<uint32_t> &order)
+{
+    auto reorder = [&order](std::vector<glm::uvec3> &T, std::vector<glm::vec3> &V)
+    {
+        std::vector<glm::uvec3> new_T(order.size());
+        std::vector<glm::vec3> new_V;
+        new_V.reserve(V.size());
+        std::vector<uint32_t> new_index(V.size(), UINT32_MAX);
+
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const auto &t = T[order[i]];
+            for (uint32_t j = 0; j < 3; j++)
+            {
+                if (new_index[t[j]] == UINT32_MAX)
+                {
+                    new_index[t[j]] = (uint32_t)new_V.size();
+                    new_V.push_back(V[t[j]]);
+                }
+                new_T[i][j] = new_index[t[j]];
+            }
+        }
+        new_V.shrink_to_fit();
+
+        T = std::move(new_T);
+        V = std::move(new_V);
+    };
+
+    reorder(triangles, vertices);
+    if (!triangle_normals.empty())
+    {
+        reorder(triangle_normals, normals);
+    }
+}
+
+void Surface::Mesh::computeBoundingBox()
+{
+    BB_ = BoundingBox();
+    for (uint32_t i = 0; i < triangles.size(); i++)
+    {
+        BB_.merge(primitiveBB(i));
+    }
+}
+
+void Surface::Mesh::computeArea()
+{
+    area_ = 0.0;
+    for (const auto &t : triangles)
+    {
+        glm::dvec3 v0 = vertices[t.x];
+        area_ += glm::length(glm::cross(glm::dvec3(vertices[t.y]) - v0, glm::dvec3(vertices[t.z]) - v0)) / 2.0;
+    }
+}
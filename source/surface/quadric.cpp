@@ -66,7 +66,7 @@ Surface::Quadric::Quadric(const nlohmann::json &j, std::shared_ptr<Material> mat
  then we can find eventual ray intersections by solving the quadratic equation: 
  a*t^2 + b*t + c = 0
 /**********************************************************************/
-bool Surface::Quadric::intersect(const Ray& ray, Intersection& intersection) const
+bool Surface::Quadric::intersect(const Ray& ray, uint32_t /*primitive*/, Intersection& intersection) const
 {
     // Intersect with bounding box and start at this 
     // intersection to render the sliced quadric correctly.
@@ -121,7 +121,7 @@ void Surface::Quadric::transform(const Transform &T)
     computeBoundingBox();
 }
 
-glm::dvec3 Surface::Quadric::operator()(double u, double v) const
+glm::dvec3 Surface::Quadric::operator()(double /*u*/, double /*v*/) const
 {
     return glm::dvec3();
 }
@@ -10,7 +10,7 @@ Surface::Sphere::Sphere(double radius, std::shared_ptr<Material> material)
     computeBoundingBox();
 }
 
-bool Surface::Sphere::intersect(const Ray& ray, Intersection& intersection) const
+bool Surface::Sphere::intersect(const Ray& ray, uint32_t /*primitive*/, Intersection& intersection) const
 {
     glm::dvec3 so = ray.start - origin;
     double b = 2.0 * glm::dot(ray.direction, so);
@@ -10,6 +10,8 @@
 #include "../common/util.hpp"
 
 class Material;
+class BVH;
+namespace Bundle { class Reader; class Writer; }
 
 namespace Surface
 {
@@ -21,16 +23,55 @@ namespace Surface
 
         virtual ~Base() { }
 
-        virtual bool intersect(const Ray& ray, Intersection& intersection) const = 0;
+        // Primitive is the index of the primitive to test, always 0 for single primitive surfaces.
+        // Sets all fields of intersection except surface, which is set by the caller.
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const = 0;
         virtual glm::dvec3 operator()(double u, double v) const = 0;
         virtual glm::dvec3 normal(const glm::dvec3& pos) const = 0;
         virtual void transform(const Transform &T) = 0;
 
-        virtual glm::dvec3 interpolatedNormal(const glm::dvec2& uv) const 
+        // Normal of the intersected primitive
+        virtual glm::dvec3 normal(const Intersection& /*intersection*/, const glm::dvec3& pos) const
+        {
+            return normal(pos);
+        }
+
+        virtual glm::dvec3 interpolatedNormal(const Intersection& /*intersection*/) const 
         { 
             return glm::dvec3(); 
         }
 
+        // Any-hit test for shadow rays, true if the ray intersects the primitive before t_max.
+        virtual bool occludes(const Ray& ray, uint32_t primitive, double t_max) const
+        {
+            Intersection intersection;
+            return intersect(ray, primitive, intersection) && intersection.t < t_max;
+        }
+
+        // Surfaces such as triangle meshes consist of several primitives that are 
+        // bounded separately by the BVH, which can also reorder them to match the tree.
+        virtual uint32_t numPrimitives() const
+        {
+            return 1;
+        }
+
+        virtual BoundingBox primitiveBB(uint32_t /*primitive*/) const
+        {
+            return BB_;
+        }
+
+        virtual void reorderPrimitives(const std::vector<uint32_t> &/*order*/) { }
+
+        // Splits the part of the primitive inside BB by a plane perpendicular to axis, and returns 
+        // bounding boxes of the parts on each side. Used by the spatial splits of SBVH construction.
+        virtual void splitPrimitive(uint32_t /*primitive*/, const BoundingBox &BB, int axis, double position,
+                                    BoundingBox &left, BoundingBox &right) const
+        {
+            left = right = BB;
+            left.max[axis] = std::min(left.max[axis], position);
+            right.min[axis] = std::max(right.min[axis], position);
+        }
+
         BoundingBox BB() const
         {
             return BB_;
@@ -55,7 +96,7 @@ namespace Surface
     public:
         Sphere(double radius, std::shared_ptr<Material> material);
 
-        virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const;
         virtual glm::dvec3 operator()(double u, double v) const;
         virtual glm::dvec3 normal(const glm::dvec3& pos) const;
         virtual void transform(const Transform &T);
@@ -77,12 +118,16 @@ namespace Surface
         Triangle(const glm::dvec3& v0, const glm::dvec3& v1, const glm::dvec3& v2,
                  const glm::dvec3& n0, const glm::dvec3& n1, const glm::dvec3& n2, std::shared_ptr<Material> material);
 
-        virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const;
+        virtual bool occludes(const Ray& ray, uint32_t primitive, double t_max) const;
         virtual glm::dvec3 operator()(double u, double v) const;
         virtual glm::dvec3 normal(const glm::dvec3& pos) const;
-        virtual glm::dvec3 interpolatedNormal(const glm::dvec2& uv) const;
+        virtual glm::dvec3 interpolatedNormal(const Intersection& intersection) const;
         virtual void transform(const Transform &T);
 
+        virtual void splitPrimitive(uint32_t primitive, const BoundingBox &BB, int axis, double position,
+                                    BoundingBox &left, BoundingBox &right) const;
+
         glm::dvec3 normal() const;
 
     protected:
@@ -96,12 +141,97 @@ namespace Surface
         glm::dvec3 E1, E2, normal_;
     };
 
+    /**************************************************************************
+     Indexed triangle mesh. Vertices and normals are shared between triangles 
+     and stored as floats, which makes a mesh triangle much smaller than a 
+     Triangle. Meshes are never emissive since emissive objects need separate 
+     materials for each triangle, and can therefore not be sampled as lights.
+    ***************************************************************************/
+    class Mesh : public Base
+    {
+    public:
+        Mesh(const std::vector<glm::dvec3> &vertices, 
+             const std::vector<glm::dvec3> &normals,
+             const std::vector<glm::uvec3> &triangles_v,
+             const std::vector<glm::uvec3> &triangles_vn,
+             std::shared_ptr<Material> material);
+
+        // Reads a mesh written by write(), in the state it was in when it was written
+        Mesh(Bundle::Reader &bundle, std::shared_ptr<Material> material);
+
+        void write(Bundle::Writer &bundle) const;
+
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const;
+        virtual bool occludes(const Ray& ray, uint32_t primitive, double t_max) const;
+        virtual glm::dvec3 operator()(double u, double v) const;
+        virtual glm::dvec3 normal(const glm::dvec3& pos) const;
+        virtual glm::dvec3 normal(const Intersection& intersection, const glm::dvec3& pos) const;
+        virtual glm::dvec3 interpolatedNormal(const Intersection& intersection) const;
+        virtual void transform(const Transform &T);
+
+        virtual uint32_t numPrimitives() const;
+        virtual BoundingBox primitiveBB(uint32_t primitive) const;
+        virtual void reorderPrimitives(const std::vector<uint32_t> &order);
+
+        virtual void splitPrimitive(uint32_t primitive, const BoundingBox &BB, int axis, double position,
+                                    BoundingBox &left, BoundingBox &right) const;
+
+    protected:
+        virtual void computeArea();
+        virtual void computeBoundingBox();
+
+    private:
+        std::vector<glm::vec3> vertices, normals;
+        std::vector<glm::uvec3> triangles;        // vertex indices
+        std::vector<glm::uvec3> triangle_normals; // normal indices, empty if not smooth
+    };
+
+    // Ray-triangle intersection, u and v are the barycentric coordinates of v1 and v2.
+    bool mollerTrumbore(const Ray& ray, const glm::dvec3& v0, const glm::dvec3& E1, const glm::dvec3& E2,
+                        double& t, double& u, double& v);
+
+    void splitTriangle(const glm::dvec3& v0, const glm::dvec3& v1, const glm::dvec3& v2, const BoundingBox &BB,
+                       int axis, double position, BoundingBox &left, BoundingBox &right);
+
+    /**************************************************************************
+     Instance of a mesh that is shared by several objects. The mesh is stored
+     once in object space together with its own bottom-level BVH, and rays are
+     transformed into object space before they are traced through that BVH.
+     The mesh primitive that was hit is returned in the intersection.
+    ***************************************************************************/
+    class Instance : public Base
+    {
+    public:
+        Instance(std::shared_ptr<Mesh> mesh, std::shared_ptr<BVH> bvh, std::shared_ptr<Material> material);
+
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const;
+        virtual bool occludes(const Ray& ray, uint32_t primitive, double t_max) const;
+        virtual glm::dvec3 operator()(double u, double v) const;
+        virtual glm::dvec3 normal(const glm::dvec3& pos) const;
+        virtual glm::dvec3 normal(const Intersection& intersection, const glm::dvec3& pos) const;
+        virtual glm::dvec3 interpolatedNormal(const Intersection& intersection) const;
+        virtual void transform(const Transform &T);
+
+    protected:
+        virtual void computeArea() { }
+        virtual void computeBoundingBox();
+
+    private:
+        Ray toObject(const Ray& ray) const;
+
+        std::shared_ptr<Mesh> mesh;
+        std::shared_ptr<BVH> bvh;
+
+        glm::dmat4 to_world, to_object;
+        glm::dmat3 normal_matrix;
+    };
+
     class Quadric : public Base
     {
     public:
         Quadric(const nlohmann::json &j, std::shared_ptr<Material> material);
 
-        virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+        virtual bool intersect(const Ray& ray, uint32_t primitive, Intersection& intersection) const;
         virtual glm::dvec3 operator()(double u, double v) const;
         virtual glm::dvec3 normal(const glm::dvec3& pos) const;
         virtual void transform(const Transform &T);
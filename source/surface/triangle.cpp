@@ -20,7 +20,33 @@ Surface::Triangle::Triangle(const glm::dvec3& v0, const glm::dvec3& v1, const gl
     computeBoundingBox();
 }
 
-bool Surface::Triangle::intersect(const Ray& ray, Intersection& intersection) const
+bool Surface::Triangle::intersect(const Ray& ray, uint32_t /*primitive*/, Intersection& intersection) const
+{
+    double t, u, v;
+    if (!mollerTrumbore(ray, v0, E1, E2, t, u, v))
+    {
+        return false;
+    }
+
+    intersection = Intersection(t);
+
+    if (N)
+    {
+        intersection.uv = { u, v };
+        intersection.interpolate = true;
+    }
+
+    return true;
+}
+
+bool Surface::Triangle::occludes(const Ray& ray, uint32_t /*primitive*/, double t_max) const
+{
+    double t, u, v;
+    return mollerTrumbore(ray, v0, E1, E2, t, u, v) && t < t_max;
+}
+
+bool Surface::mollerTrumbore(const Ray& ray, const glm::dvec3& v0, const glm::dvec3& E1, const glm::dvec3& E2,
+                              double& t, double& u, double& v)
 {
     glm::dvec3 P = glm::cross(ray.direction, E2);
     double determinant = glm::dot(P, E1);
@@ -32,34 +58,60 @@ bool Surface::Triangle::intersect(const Ray& ray, Intersection& intersection) co
     double inv_determinant = 1.0 / determinant;
 
     glm::dvec3 T = ray.start - v0;
-    double u = glm::dot(P, T) * inv_determinant;
+    u = glm::dot(P, T) * inv_determinant;
     if (u > 1.0 || u < 0.0)
     {
         return false;
     }
 
     glm::dvec3 Q = glm::cross(T, E1);
-    double v = glm::dot(Q, ray.direction) * inv_determinant;
+    v = glm::dot(Q, ray.direction) * inv_determinant;
     if (v > 1.0 || v < 0.0 || u + v > 1.0)
     {
         return false;
     }
 
-    double t = glm::dot(Q, E2) * inv_determinant;
-    if (t <= 0.0)
-    {
-        return false;
-    }
+    t = glm::dot(Q, E2) * inv_determinant;
+    return t > 0.0;
+}
 
-    intersection = Intersection(t);
+void Surface::Triangle::splitPrimitive(uint32_t /*primitive*/, const BoundingBox &BB, int axis, double position,
+                                       BoundingBox &left, BoundingBox &right) const
+{
+    splitTriangle(v0, v1, v2, BB, axis, position, left, right);
+}
 
-    if (N)
+/*****************************************************************************
+ Bounds the two parts of the triangle on each side of the split plane by the
+ vertices on each side and the points where the edges cross the plane. The 
+ parts are then clipped by BB, which bounds the part of the triangle that is 
+ left after previous splits.
+******************************************************************************/
+void Surface::splitTriangle(const glm::dvec3& v0, const glm::dvec3& v1, const glm::dvec3& v2, const BoundingBox &BB,
+                            int axis, double position, BoundingBox &left, BoundingBox &right)
+{
+    left = right = BoundingBox();
+
+    const glm::dvec3* v[3] = { &v0, &v1, &v2 };
+    for (int i = 0; i < 3; i++)
     {
-        intersection.uv = { u, v };
-        intersection.interpolate = true;
+        const auto &a = *v[i];
+        const auto &b = *v[(i + 1) % 3];
+
+        if (a[axis] <= position) left.merge(a);
+        if (a[axis] >= position) right.merge(a);
+
+        if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+        {
+            glm::dvec3 p = glm::mix(a, b, (position - a[axis]) / (b[axis] - a[axis]));
+            p[axis] = position;
+            left.merge(p);
+            right.merge(p);
+        }
     }
 
-    return true;
+    left.clip(BB);
+    right.clip(BB);
 }
 
 void Surface::Triangle::transform(const Transform &T)
@@ -96,7 +148,7 @@ glm::dvec3 Surface::Triangle::operator()(double u, double v) const
     return (1 - su) * v0 + (1 - v) * su * v1 + v * su * v2;
 }
 
-glm::dvec3 Surface::Triangle::normal(const glm::dvec3& pos) const
+glm::dvec3 Surface::Triangle::normal(const glm::dvec3& /*pos*/) const
 {
     return normal_;
 }
@@ -106,9 +158,10 @@ glm::dvec3 Surface::Triangle::normal() const
     return normal_;
 }
 
-glm::dvec3 Surface::Triangle::interpolatedNormal(const glm::dvec2& uv) const
+glm::dvec3 Surface::Triangle::interpolatedNormal(const Intersection& intersection) const
 {
     const auto &vn = *N;
+    const auto &uv = intersection.uv;
     return glm::normalize((1.0 - uv.x - uv.y) * vn[0] + uv.x * vn[1] + uv.y * vn[2]);
 }
 